@@ -4,73 +4,213 @@
 #include <array>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 
 #include "fmt/format.h"
 #include "kvfile.hpp"
+#include "split_range.hpp"
 
-//not thread safe
-template<std::size_t n_block>
+//blocks being emptied by compaction : no allocator hands them out or keeps
+//them free meanwhile , they all come back at once when it is done.
+//shared by the allocators of every partition , empty when beg == end
+struct block_window : disable_copy{
+    std::atomic<uint32_t> beg{0};
+    std::atomic<uint32_t> end{0};
+
+    block_window() = default;
+
+    bool overlaps(uint32_t addr , uint32_t n) const{
+        //ordered against the key locks of writers , see NvmEngine::compact_partition
+        const uint32_t b = beg.load() , e = end.load();
+        return addr < e && addr + n > b;
+    }
+};
+
+//not thread safe.
+//a value lives in one run of 1 to max_run 128B blocks. runs of more than one
+//block start on a 256B line , a single block may take either half of one.
+//free runs are kept by length , fresh space is carved from the tail and
+//a larger free run is split only once the tail is used up.
+//other partitions may borrow chunks from the far end of the fresh space.
 class value_block_allocator{
 public:
     static constexpr uint32_t null_index = 0xffffffff;
-    static constexpr uint32_t total_block_num = n_block;
+    static constexpr uint32_t max_run = 8;      //1KB
 public:
     value_block_allocator() = default;
 
-    void init(uint32_t beg , uint32_t off){
+    //off is rounded up to a 256B line
+    void init(uint32_t beg , uint32_t off , uint32_t n_block){
         this->beg = beg;
-        this->off = off;
+        this->n_block = n_block;
+        fresh_span.init(std::min(off + (off & 1) , n_block) , n_block);
 
-        free_block_256.reserve(7_MB);
+        free_runs[1].reserve(1_MB);
     }
 
-    uint32_t allocate_128(){
-        uint32_t addr{null_index};
-        if(!free_block_128.empty()){ 
-            addr = free_block_128.back();
-            free_block_128.pop_back();
-        }else{
-            addr = allocate_256();
-            if(likely(addr != null_index))
-                free_block_128.push_back(addr +1);
+    void attach(const block_window * window){
+        this->window = window;
+    }
+
+    //fresh == false keeps the tail untouched
+    uint32_t allocate(uint32_t n , bool fresh = true){
+        assert(n >= 1 && n <= max_run);
+        auto & exact = free_runs[n - 1];
+        while(!exact.empty()){
+            auto addr = exact.back();
+            exact.pop_back();
+            if(likely(!hidden(addr , n)))
+                return addr;
+            recollect(addr , n);
+        }
+
+        if(fresh){
+            //whole lines , the other half of the last one is kept free
+            const auto off = fresh_span.take(n + (n & 1));
+            if(off != split_range::null_off){
+                if(n & 1)
+                    free_runs[0].push_back(beg + off + n);
+                return beg + off;
+            }
         }
 
-        return addr ;
+        for(uint32_t m = n + 1 ; m <= max_run ; ++m){
+            auto & larger = free_runs[m - 1];
+            while(!larger.empty()){
+                auto addr = larger.back();
+                larger.pop_back();
+                if(unlikely(hidden(addr , m))){
+                    recollect(addr , m);
+                    continue;
+                }
+                recollect(addr + n , m - n);
+                return addr;
+            }
+        }
+        return null_index;
+    }
+
+    void recollect(uint32_t addr , uint32_t n){
+        //only the parts out of a window are kept
+        if(unlikely(hidden(addr , n))){
+            const uint32_t b = window->beg.load() , e = window->end.load();
+            if(addr < b)
+                recollect(addr , b - addr);
+            if(addr + n > e)
+                recollect(e , addr + n - e);
+            return;
+        }
+
+        //a run off the line gives up its first half block
+        if(n > 1 && (addr & 1)){
+            free_runs[0].push_back(addr);
+            ++addr , --n;
+        }
+        free_runs[n - 1].push_back(addr);
     }
 
-    uint32_t allocate_256(){
-        uint32_t addr{null_index};
+    //a free gap of any length , as found by recovery
+    void recollect_gap(uint32_t addr , uint32_t n){
+        if(n && (addr & 1)){
+            free_runs[0].push_back(addr);
+            ++addr , --n;
+        }
+        for(; n >= max_run ; addr += max_run , n -= max_run)
+            free_runs[max_run - 1].push_back(addr);
+        if(n)
+            free_runs[n - 1].push_back(addr);
+    }
 
-        if(!free_block_256.empty()){
-            addr = free_block_256.back();
-            free_block_256.pop_back();
-        }else if(off + 1 < n_block){
-            addr = beg + off;
-            off += 2;
+    //drops every free run within the window , keeping parts out of it
+    void purge(){
+        std::vector<std::pair<uint32_t , uint32_t>> kept{};
+        for(uint32_t n = 1 ; n <= max_run ; ++n){
+            auto & runs = free_runs[n - 1];
+            runs.erase(std::remove_if(runs.begin() , runs.end() , [this , n , &kept](uint32_t addr){
+                if(!hidden(addr , n)) return false;
+                kept.emplace_back(addr , n);
+                return true;
+            }) , runs.end());
         }
-        return addr;
+        for(auto & run : kept)
+            recollect(run.first , run.second);
     }
 
-    void recollect_128(uint32_t addr){
-        free_block_128.push_back(addr);
+    //gives back the tail from off on
+    void shrink(uint32_t off){
+        fresh_span.set_low(off - beg);
     }
 
-    void recollect_256(uint32_t addr){
-        free_block_256.push_back(addr);
+    //end of the space handed out from the tail
+    uint32_t tail() const{
+        return beg + fresh_span.low();
     }
-    
+
+    //n fresh blocks for another partition , from the far end.
+    //lock free , the owner may be allocating meanwhile
+    uint32_t lend(uint32_t n){
+        const auto off = fresh_span.take_top(n);
+        return off == split_range::null_off ? null_index : beg + off;
+    }
+
+    uint32_t free_block_num() const{
+        uint32_t n = 0;
+        for(uint32_t i = 0 ; i < max_run ; ++i)
+            n += free_runs[i].size() * (i + 1);
+        return n;
+    }
+
+    bool dump(FILE * f) const{
+        const uint32_t lo = fresh_span.low() , hi = fresh_span.high();
+        bool ok = dump_pod(f , &beg) && dump_pod(f , &lo) && dump_pod(f , &hi) && dump_pod(f , &n_block);
+        for(auto & runs : free_runs)
+            ok = ok && dump_vector(f , runs);
+        return ok;
+    }
+
+    bool load(FILE * f){
+        uint32_t lo{} , hi{};
+        bool ok = load_pod(f , &beg) && load_pod(f , &lo) && load_pod(f , &hi) && load_pod(f , &n_block);
+        for(auto & runs : free_runs)
+            ok = ok && load_vector(f , runs);
+        fresh_span.init(lo , hi);
+        return ok;
+    }
+
+    //free runs dropped , init() lays the span out again
+    void clear(){
+        for(auto & runs : free_runs)
+            runs.clear();
+    }
+
+    uint32_t total_block_num() const{
+        return n_block;
+    }
+
     std::string space_use_log(){
-        return fmt::format("[{} , {} , remains {}]" , free_block_128.size() , free_block_256.size() , n_block - off );
+        std::string log{"["};
+        for(auto & runs : free_runs)
+            log += fmt::format("{} , " , runs.size());
+        return log + fmt::format("remains {}]" , fresh_span.high() - fresh_span.low());
+    }
+
+private:
+
+    bool hidden(uint32_t addr , uint32_t n) const{
+        return window && window->overlaps(addr , n);
     }
 
 private:
 
     uint32_t beg{0};
-    uint32_t off{0};
+    uint32_t n_block{0};
+    split_range fresh_span;     //[tail , end of lent chunks)
 
-    std::vector<uint32_t> free_block_128;
-    std::vector<uint32_t> free_block_256;
+    std::array<std::vector<uint32_t> , max_run> free_runs;     //by length - 1
+    const block_window * window{nullptr};
 
 };
 
-#endif
\ No newline at end of file
+#endif
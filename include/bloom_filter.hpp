@@ -2,11 +2,11 @@
 #define BOOLEAN_FILTER_INCLUDE_H
 
 #include <atomic>
-#include <array>
+#include <memory>
+#include <algorithm>
 
 #include "include/utils.hpp"
 
-template<std::size_t N>
 class bitmap_filter:disable_copy{
     struct inner_block{
         std::atomic<uint8_t> value;
@@ -23,11 +23,17 @@ class bitmap_filter:disable_copy{
         }
     };
 public:
-    static constexpr std::size_t max_index = ( N % 8 == 0 ? N : (N / 8 + 1) * 8);
-    static_assert(max_index % 8 == 0 , "incorrect max_index .");
-public:
-    explicit bitmap_filter()
-    :_bitset(){
+    explicit bitmap_filter(std::size_t n)
+    :max_size((n + 7) / 8) , _bitset(new inner_block[max_size]){
+    }
+
+    std::size_t max_index() const{
+        return max_size * 8;
+    }
+
+    //bit of a hash , without a division
+    std::size_t slot(uint64_t hash) const{
+        return fast_range(hash , max_index());
     }
 
     bool test(std::size_t i ) const{
@@ -40,9 +46,94 @@ public:
         _bitset[i >> 3].set(i & 0x07);
     }
     
+    bool dump(FILE * f) const{
+        return dump_pod(f , reinterpret_cast<const uint8_t *>(_bitset.get()) , max_size);
+    }
+
+    bool load(FILE * f){
+        return load_pod(f , reinterpret_cast<uint8_t *>(_bitset.get()) , max_size);
+    }
+
+private:
+    const std::size_t max_size;
+    std::unique_ptr<inner_block[]> _bitset;
+};
+
+//blocked bloom filter : all probes of a key fall in one 64B line , one
+//bit in each of its 8 words , so a test is a single cache miss and four
+//SSE2 and-nots. the line comes from the high bits of the hash , the bit
+//positions from a remix of it
+class blocked_bloom:disable_copy{
+public:
+    static constexpr uint32_t words_per_line = CACHELINE_SIZE / sizeof(uint64_t);
+
+    //about n bits , at least one line
+    explicit blocked_bloom(std::size_t n)
+    :n_line(std::max<std::size_t>((n + 511) / 512 , 1)) , raw(new std::atomic<uint64_t>[(n_line + 1) * words_per_line]){
+        auto p = reinterpret_cast<uintptr_t>(raw.get());
+        words = reinterpret_cast<std::atomic<uint64_t> *>((p + CACHELINE_SIZE - 1) & ~uintptr_t(CACHELINE_SIZE - 1));
+        for(std::size_t i = 0 ; i < n_line * words_per_line ; ++i)
+            words[i].store(0 , std::memory_order_relaxed);
+    }
+
+    std::size_t max_index() const{
+        return n_line * 512;
+    }
+
+    void prefetch(uint64_t hash) const{
+        prefetch_t0(line_of(hash));
+    }
+
+    bool may_contain(uint64_t hash) const{
+        alignas(16) uint64_t mask[words_per_line];
+        make_mask(hash , mask);
+        auto line = reinterpret_cast<const __m128i *>(line_of(hash));
+        auto m = reinterpret_cast<const __m128i *>(mask);
+        __m128i miss = _mm_andnot_si128(_mm_load_si128(line) , _mm_load_si128(m));
+        miss = _mm_or_si128(miss , _mm_andnot_si128(_mm_load_si128(line + 1) , _mm_load_si128(m + 1)));
+        miss = _mm_or_si128(miss , _mm_andnot_si128(_mm_load_si128(line + 2) , _mm_load_si128(m + 2)));
+        miss = _mm_or_si128(miss , _mm_andnot_si128(_mm_load_si128(line + 3) , _mm_load_si128(m + 3)));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(miss , _mm_setzero_si128())) == 0xffff;
+    }
+
+    void add(uint64_t hash){
+        uint64_t mask[words_per_line];
+        make_mask(hash , mask);
+        auto line = line_of(hash);
+        for(uint32_t i = 0 ; i < words_per_line ; ++i)
+            if(!(line[i].load(std::memory_order_relaxed) & mask[i]))
+                line[i].fetch_or(mask[i] , std::memory_order_relaxed);
+    }
+
+    bool dump(FILE * f) const{
+        return dump_pod(f , reinterpret_cast<const uint64_t *>(words) , n_line * words_per_line);
+    }
+
+    bool load(FILE * f){
+        return load_pod(f , reinterpret_cast<uint64_t *>(words) , n_line * words_per_line);
+    }
+
+    void clear(){
+        for(std::size_t i = 0 ; i < n_line * words_per_line ; ++i)
+            words[i].store(0 , std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> * line_of(uint64_t hash) const{
+        return words + fast_range(hash , n_line) * words_per_line;
+    }
+
+    //6 bits per word out of an odd multiply of the hash
+    static void make_mask(uint64_t hash , uint64_t * mask){
+        const uint64_t h = hash * 0x9e3779b97f4a7c15ull;
+        for(uint32_t i = 0 ; i < words_per_line ; ++i)
+            mask[i] = uint64_t(1) << ((h >> (64 - 6 * (i + 1))) & 63);
+    }
+
 private:
-    static constexpr std::size_t max_size = max_index / 8;
-    std::array<inner_block , max_size> _bitset;
+    const std::size_t n_line;
+    std::unique_ptr<std::atomic<uint64_t>[]> raw;
+    std::atomic<uint64_t> * words;
 };
 
-#endif
\ No newline at end of file
+#endif
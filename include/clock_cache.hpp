@@ -0,0 +1,265 @@
+#ifndef CLOCK_CACHE_INCLUDE_H
+#define CLOCK_CACHE_INCLUDE_H
+
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+
+#include "utils.hpp"
+
+//value cache shared by all threads , keyed by key_index and tagged with
+//the version of the value , so a stale entry simply misses.
+//entries are grouped in sets of 8 ways , each set is a shard with its own
+//lock , CLOCK hand and 4KB of 128B chunks for values , so a value takes
+//only the chunks its size needs and memory is bounded by bytes , not entries.
+//readers take no lock and store nothing but the reference bit : an entry
+//is copied under its sequence number and the copy is dropped if a writer
+//got in meanwhile.
+template<std::size_t max_value>
+class clock_cache : disable_copy{
+public:
+    static constexpr uint32_t ways = 8;
+    static constexpr uint32_t null_key = 0xffffffff;
+    static constexpr std::size_t key_size = 16;
+    static constexpr uint32_t chunk_size = 128;
+    static constexpr uint32_t set_chunks = 32;      //512B a way on average
+    static_assert(max_value <= chunk_size * 8 , "a chunk list holds 8 chunks");
+
+private:
+
+    struct alignas(CACHELINE_SIZE) set_info{
+        std::atomic<uint32_t> keys[ways];
+        std::atomic<uint8_t> refs[ways];
+        std::atomic<uint8_t> lock;
+        uint8_t hand;
+        std::atomic<uint32_t> free;     //bitmap of free chunks
+    };
+
+    struct alignas(CACHELINE_SIZE) entry{
+        std::atomic<uint32_t> seq;      //odd while written
+        std::atomic<uint32_t> key_index;
+        std::atomic<uint32_t> ver;
+        std::atomic<uint32_t> len;
+        std::atomic<uint64_t> chunks;   //chunk ids in the set , a byte each
+        char key[key_size];
+    };
+
+    static constexpr std::size_t meta_size = sizeof(set_info) + ways * sizeof(entry);
+    static constexpr std::size_t set_size = meta_size + set_chunks * chunk_size;
+
+public:
+
+    //budget in bytes , metadata included. never less than one set
+    explicit clock_cache(std::size_t budget)
+    :n_set(std::max<std::size_t>(1 , budget / set_size)) ,
+        sets(new set_info[n_set]) , entries(new entry[n_set * ways]) ,
+        arena(new char[n_set * set_chunks * chunk_size]){
+        for(std::size_t i = 0 ; i < n_set ; ++i){
+            for(uint32_t w = 0 ; w < ways ; ++w){
+                sets[i].keys[w].store(null_key , std::memory_order_relaxed);
+                sets[i].refs[w].store(0 , std::memory_order_relaxed);
+                entries[i * ways + w].seq.store(0 , std::memory_order_relaxed);
+                entries[i * ways + w].key_index.store(null_key , std::memory_order_relaxed);
+                entries[i * ways + w].len.store(0 , std::memory_order_relaxed);
+            }
+            sets[i].lock.store(0 , std::memory_order_relaxed);
+            sets[i].hand = 0;
+            sets[i].free.store(all_chunks , std::memory_order_relaxed);
+        }
+    }
+
+    //dest(key , len) returns where the value goes , or nullptr to skip it.
+    //it may run more than once , only the last run counts
+    template<class F>
+    bool get(uint32_t key_index , uint32_t ver , F && dest){
+        const std::size_t i = set_of(key_index);
+        auto & set = sets[i];
+        const uint32_t w = find(set , key_index);
+        if(w == ways) return false;
+
+        auto & e = entries[i * ways + w];
+        for(uint32_t retry = 0 ; retry < 2 ; ++retry){
+            const uint32_t seq = e.seq.load(std::memory_order_acquire);
+            if(seq & 1) return false;
+
+            const bool hit = e.key_index.load(std::memory_order_relaxed) == key_index
+                && e.ver.load(std::memory_order_relaxed) == ver;
+            if(hit){
+                const uint32_t len = std::min<uint32_t>(e.len.load(std::memory_order_relaxed) , max_value);
+                const uint64_t chunks = e.chunks.load(std::memory_order_relaxed);
+                if(char * out = dest(e.key , len)){
+                    for(uint32_t off = 0 , k = 0 ; off < len ; off += chunk_size , ++k)
+                        memcpy(out + off , chunk(i , (chunks >> (k * 8)) & 0xff) , std::min(chunk_size , len - off));
+                }
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(e.seq.load(std::memory_order_relaxed) != seq) continue;
+
+            if(hit && !set.refs[w].load(std::memory_order_relaxed))
+                set.refs[w].store(1 , std::memory_order_relaxed);
+            return hit;
+        }
+        return false;
+    }
+
+    //best effort , skipped if the set is being written by another thread.
+    //a value evicts as many entries as it needs chunks , admit(victim key_index)
+    //decides whether a new key may evict each live one.
+    //true if the value is stored
+    template<class F>
+    bool put(uint32_t key_index , uint32_t ver , const char * key , const char * value , uint32_t len , F && admit){
+        if(len > max_value) return false;
+        const uint32_t need = chunk_cnt(len);
+
+        const std::size_t i = set_of(key_index);
+        auto & set = sets[i];
+        if(set.lock.load(std::memory_order_relaxed) || set.lock.exchange(1 , std::memory_order_acquire))
+            return false;
+
+        //the old version goes first , it is never worth keeping
+        uint32_t w = find(set , key_index);
+        if(w != ways) drop(i , w);
+
+        //pick victims by CLOCK until a way and enough chunks are free
+        uint32_t free = set.free.load(std::memory_order_relaxed) , victims = 0;
+        w = find(set , null_key);
+        while(w == ways || uint32_t(__builtin_popcount(free)) < need){
+            const uint32_t v = evict(set , victims);
+            victims |= 1u << v;
+            free |= chunk_mask(entries[i * ways + v]);
+            if(w == ways) w = v;
+        }
+        for(uint32_t v = 0 ; v < ways ; ++v){
+            if((victims >> v & 1) && !admit(set.keys[v].load(std::memory_order_relaxed))){
+                set.lock.store(0 , std::memory_order_release);
+                return false;
+            }
+        }
+        for(uint32_t v = 0 ; v < ways ; ++v){
+            if(victims >> v & 1) drop(i , v);
+        }
+
+        auto & e = entries[i * ways + w];
+        const uint32_t seq = e.seq.load(std::memory_order_relaxed);
+        e.seq.store(seq + 1 , std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64_t chunks = 0;
+        free = set.free.load(std::memory_order_relaxed);
+        for(uint32_t k = 0 ; k < need ; ++k){
+            const uint32_t c = __builtin_ctz(free);
+            free &= free - 1;
+            chunks |= uint64_t(c) << (k * 8);
+            memcpy(chunk(i , c) , value + k * chunk_size , std::min(chunk_size , len - k * chunk_size));
+        }
+        set.free.store(free , std::memory_order_relaxed);
+
+        set.keys[w].store(key_index , std::memory_order_relaxed);
+        e.key_index.store(key_index , std::memory_order_relaxed);
+        e.ver.store(ver , std::memory_order_relaxed);
+        e.len.store(len , std::memory_order_relaxed);
+        e.chunks.store(chunks , std::memory_order_relaxed);
+        memcpy(e.key , key , key_size);
+
+        e.seq.store(seq + 2 , std::memory_order_release);
+        set.lock.store(0 , std::memory_order_release);
+        return true;
+    }
+
+    bool put(uint32_t key_index , uint32_t ver , const char * key , const char * value , uint32_t len){
+        return put(key_index , ver , key , value , len , [](uint32_t){ return true; });
+    }
+
+    //most entries it may hold
+    std::size_t capacity() const{
+        return n_set * ways;
+    }
+
+    //bytes allocated , within the budget unless it is below one set
+    std::size_t memory_size() const{
+        return n_set * set_size;
+    }
+
+    //bytes in use : metadata plus the chunks holding values
+    std::size_t footprint() const{
+        std::size_t used = 0;
+        for(std::size_t i = 0 ; i < n_set ; ++i)
+            used += set_chunks - __builtin_popcount(sets[i].free.load(std::memory_order_relaxed));
+        return n_set * meta_size + used * chunk_size;
+    }
+
+private:
+
+    static constexpr uint32_t all_chunks = uint32_t((uint64_t(1) << set_chunks) - 1);
+
+    static uint32_t chunk_cnt(uint32_t len){
+        return (len + chunk_size - 1) / chunk_size;
+    }
+
+    std::size_t set_of(uint32_t key_index) const{
+        //key_index is dense , spread it before picking a set
+        return fast_range(uint64_t(key_index * 0x9e3779b1u) << 32 , n_set);
+    }
+
+    char * chunk(std::size_t set , uint32_t c) const{
+        return arena.get() + (set * set_chunks + c) * chunk_size;
+    }
+
+    static uint32_t chunk_mask(const entry & e){
+        const uint64_t chunks = e.chunks.load(std::memory_order_relaxed);
+        uint32_t mask = 0;
+        for(uint32_t k = 0 , n = chunk_cnt(e.len.load(std::memory_order_relaxed)) ; k < n ; ++k)
+            mask |= 1u << ((chunks >> (k * 8)) & 0xff);
+        return mask;
+    }
+
+    //frees way w and its chunks , under the set lock
+    void drop(std::size_t i , uint32_t w){
+        auto & set = sets[i];
+        auto & e = entries[i * ways + w];
+        const uint32_t seq = e.seq.load(std::memory_order_relaxed);
+        e.seq.store(seq + 1 , std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        set.free.store(set.free.load(std::memory_order_relaxed) | chunk_mask(e) , std::memory_order_relaxed);
+        set.keys[w].store(null_key , std::memory_order_relaxed);
+        set.refs[w].store(0 , std::memory_order_relaxed);
+        e.key_index.store(null_key , std::memory_order_relaxed);
+        e.len.store(0 , std::memory_order_relaxed);
+
+        e.seq.store(seq + 2 , std::memory_order_release);
+    }
+
+    static uint32_t find(const set_info & set , uint32_t key_index){
+        uint32_t w = 0;
+        for(; w < ways ; ++w){
+            if(set.keys[w].load(std::memory_order_relaxed) == key_index) break;
+        }
+        return w;
+    }
+
+    //the first live way not referenced since the hand passed it , skipping
+    //those already picked. some live way is always left unpicked , or all
+    //chunks would be free
+    static uint32_t evict(set_info & set , uint32_t picked){
+        for(;;){
+            const uint32_t w = set.hand;
+            set.hand = (w + 1) % ways;
+            if((picked >> w & 1) || set.keys[w].load(std::memory_order_relaxed) == null_key)
+                continue;
+            if(!set.refs[w].load(std::memory_order_relaxed))
+                return w;
+            set.refs[w].store(0 , std::memory_order_relaxed);
+        }
+    }
+
+private:
+    const std::size_t n_set;
+    std::unique_ptr<set_info[]> sets;
+    std::unique_ptr<entry[]> entries;
+    std::unique_ptr<char[]> arena;
+};
+
+#endif
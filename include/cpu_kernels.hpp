@@ -0,0 +1,260 @@
+#ifndef CPU_KERNELS_INCLUDE_H
+#define CPU_KERNELS_INCLUDE_H
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+//the engine is built for baseline x86-64 (SSE2) , wider kernels are
+//compiled per function with target attributes and picked once at
+//startup from CPUID , so one binary runs on every host of the fleet.
+
+//streaming copies of whole 64B lines : dst line aligned , not ordered
+//with later stores until an sfence / pmem_drain
+__attribute__((target("avx512f")))
+static inline void stream_lines_avx512(void * dst , const void * src , size_t n_line){
+	auto d = reinterpret_cast<__m512i *>(dst);
+	auto s = reinterpret_cast<const __m512i *>(src);
+	for(size_t i = 0 ; i < n_line ; ++i)
+		_mm512_stream_si512(d + i , _mm512_loadu_si512(s + i));
+}
+
+__attribute__((target("avx2")))
+static inline void stream_lines_avx2(void * dst , const void * src , size_t n_line){
+	auto d = reinterpret_cast<__m256i *>(dst);
+	auto s = reinterpret_cast<const __m256i *>(src);
+	for(size_t i = 0 ; i < n_line * 2 ; i += 2){
+		__m256i m0 = _mm256_loadu_si256(s + i);
+		__m256i m1 = _mm256_loadu_si256(s + i + 1);
+		_mm256_stream_si256(d + i , m0);
+		_mm256_stream_si256(d + i + 1 , m1);
+	}
+}
+
+static inline void stream_lines_sse2(void * dst , const void * src , size_t n_line){
+	auto d = reinterpret_cast<__m128i *>(dst);
+	auto s = reinterpret_cast<const __m128i *>(src);
+	for(size_t i = 0 ; i < n_line * 4 ; i += 4){
+		__m128i m0 = _mm_loadu_si128(s + i);
+		__m128i m1 = _mm_loadu_si128(s + i + 1);
+		__m128i m2 = _mm_loadu_si128(s + i + 2);
+		__m128i m3 = _mm_loadu_si128(s + i + 3);
+		_mm_stream_si128(d + i , m0);
+		_mm_stream_si128(d + i + 1 , m1);
+		_mm_stream_si128(d + i + 2 , m2);
+		_mm_stream_si128(d + i + 3 , m3);
+	}
+}
+
+//CRC32C , pass ~0 first and invert the result for the standard value
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_sse42(uint32_t crc , const void * data , size_t n){
+	auto p = reinterpret_cast<const uint8_t *>(data);
+	uint64_t c = crc;
+	for(; n >= 8 ; n -= 8 , p += 8){
+		uint64_t v;
+		memcpy(&v , p , sizeof(v));
+		c = _mm_crc32_u64(c , v);
+	}
+	uint32_t r = uint32_t(c);
+	for(; n ; --n , ++p)
+		r = _mm_crc32_u8(r , *p);
+	return r;
+}
+
+//table driven , same result as the instruction
+static inline uint32_t crc32c_table(uint32_t crc , const void * data , size_t n){
+	struct table_t{
+		uint32_t t[256];
+		table_t(){
+			for(uint32_t i = 0 ; i < 256 ; ++i){
+				uint32_t c = i;
+				for(int k = 0 ; k < 8 ; ++k)
+					c = (c >> 1) ^ (0x82f63b78 & (0u - (c & 1)));
+				t[i] = c;
+			}
+		}
+	};
+	static const table_t table;
+
+	auto p = reinterpret_cast<const uint8_t *>(data);
+	for(; n ; --n , ++p)
+		crc = table.t[(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+inline std::size_t
+shift_mix(std::size_t v)
+{ return v ^ (v >> 47);}
+
+static inline size_t hash_impl(uint64_t lo, uint64_t hi){
+    constexpr size_t mul = (((size_t) 0xc6a4a793UL) << 32UL) + (size_t) 0x5bd1e995UL;
+    constexpr size_t len = 16 , seed = 0xc70f6907UL , beg = seed ^ (len * mul);
+
+    size_t hash = beg;
+ 
+	const size_t data1 = shift_mix(lo * mul) * mul ;
+    const size_t data2 = shift_mix(hi * mul) * mul;
+
+	hash ^= data1;
+	hash *= mul;
+	hash ^= data2;
+	hash *= mul;
+
+    hash = shift_mix(hash) * mul;
+    hash = shift_mix(hash);
+    return hash;
+}
+
+static inline size_t hash_bytes_16(const char * ptr){	
+	return hash_impl(*(uint64_t *)(ptr) , *(uint64_t *)(ptr + 8));
+}
+
+//hashes of keys side by side in 64-bit lanes , bit-identical to hash_bytes_16.
+//AVX2 has no 64-bit low multiply , it is put together from 32-bit ones
+__attribute__((target("avx2")))
+static inline __m256i mul64_avx2(__m256i a , __m256i b){
+	const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a , 32) , b) ,
+		_mm256_mul_epu32(a , _mm256_srli_epi64(b , 32)));
+	return _mm256_add_epi64(_mm256_mul_epu32(a , b) , _mm256_slli_epi64(cross , 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i shift_mix_avx2(__m256i v){
+	return _mm256_xor_si256(v , _mm256_srli_epi64(v , 47));
+}
+
+__attribute__((target("avx2")))
+static inline void hash_bytes_16_x4(const char * const * keys , uint64_t * out){
+	constexpr uint64_t mul = (uint64_t(0xc6a4a793UL) << 32UL) + 0x5bd1e995UL;
+	constexpr uint64_t beg = 0xc70f6907UL ^ (16 * mul);
+	auto word = [keys](int i , int half){
+		uint64_t v;
+		memcpy(&v , keys[i] + half * 8 , sizeof(v));
+		return int64_t(v);
+	};
+	const __m256i m = _mm256_set1_epi64x(int64_t(mul));
+	const __m256i lo = _mm256_set_epi64x(word(3 , 0) , word(2 , 0) , word(1 , 0) , word(0 , 0));
+	const __m256i hi = _mm256_set_epi64x(word(3 , 1) , word(2 , 1) , word(1 , 1) , word(0 , 1));
+
+	__m256i h = _mm256_set1_epi64x(int64_t(beg));
+	h = mul64_avx2(_mm256_xor_si256(h , mul64_avx2(shift_mix_avx2(mul64_avx2(lo , m)) , m)) , m);
+	h = mul64_avx2(_mm256_xor_si256(h , mul64_avx2(shift_mix_avx2(mul64_avx2(hi , m)) , m)) , m);
+	h = shift_mix_avx2(mul64_avx2(shift_mix_avx2(h) , m));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(out) , h);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i shift_mix_avx512(__m512i v){
+	return _mm512_xor_si512(v , _mm512_maskz_srli_epi64(0xff , v , 47));	//the unmasked form trips -Wmaybe-uninitialized on gcc 12
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline void hash_bytes_16_x8(const char * const * keys , uint64_t * out){
+	constexpr uint64_t mul = (uint64_t(0xc6a4a793UL) << 32UL) + 0x5bd1e995UL;
+	constexpr uint64_t beg = 0xc70f6907UL ^ (16 * mul);
+	//key i is the 128-bit lane pair (2i , 2i + 1) , split into lo and hi words
+	__m512i ab = _mm512_setzero_si512() , cd = _mm512_setzero_si512();
+	ab = _mm512_inserti64x2(ab , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[0])) , 0);
+	ab = _mm512_inserti64x2(ab , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[1])) , 1);
+	ab = _mm512_inserti64x2(ab , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[2])) , 2);
+	ab = _mm512_inserti64x2(ab , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[3])) , 3);
+	cd = _mm512_inserti64x2(cd , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[4])) , 0);
+	cd = _mm512_inserti64x2(cd , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[5])) , 1);
+	cd = _mm512_inserti64x2(cd , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[6])) , 2);
+	cd = _mm512_inserti64x2(cd , _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys[7])) , 3);
+	const __m512i even = _mm512_set_epi64(14 , 12 , 10 , 8 , 6 , 4 , 2 , 0);
+	const __m512i odd = _mm512_set_epi64(15 , 13 , 11 , 9 , 7 , 5 , 3 , 1);
+	const __m512i lo = _mm512_permutex2var_epi64(ab , even , cd);
+	const __m512i hi = _mm512_permutex2var_epi64(ab , odd , cd);
+
+	const __m512i m = _mm512_set1_epi64(int64_t(mul));
+	__m512i h = _mm512_set1_epi64(int64_t(beg));
+	h = _mm512_mullo_epi64(_mm512_xor_si512(h , _mm512_mullo_epi64(shift_mix_avx512(_mm512_mullo_epi64(lo , m)) , m)) , m);
+	h = _mm512_mullo_epi64(_mm512_xor_si512(h , _mm512_mullo_epi64(shift_mix_avx512(_mm512_mullo_epi64(hi , m)) , m)) , m);
+	h = shift_mix_avx512(_mm512_mullo_epi64(shift_mix_avx512(h) , m));
+	_mm512_storeu_si512(out , h);
+}
+
+static inline void hash_keys_scalar(const char * const * keys , size_t n , uint64_t * out){
+	for(size_t i = 0 ; i < n ; ++i)
+		out[i] = hash_bytes_16(keys[i]);
+}
+
+__attribute__((target("avx2")))
+static inline void hash_keys_avx2(const char * const * keys , size_t n , uint64_t * out){
+	size_t i = 0;
+	for(; i + 4 <= n ; i += 4)
+		hash_bytes_16_x4(keys + i , out + i);
+	hash_keys_scalar(keys + i , n - i , out + i);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline void hash_keys_avx512(const char * const * keys , size_t n , uint64_t * out){
+	size_t i = 0;
+	for(; i + 8 <= n ; i += 8)
+		hash_bytes_16_x8(keys + i , out + i);
+	hash_keys_scalar(keys + i , n - i , out + i);
+}
+
+struct cpu_kernels{
+	const char * isa;		//widest set in use
+	void (*stream_lines)(void * dst , const void * src , size_t n_line);
+	uint32_t (*crc32c)(uint32_t crc , const void * data , size_t n);
+	void (*hash_keys)(const char * const * keys , size_t n , uint64_t * out);
+
+	static const cpu_kernels & get(){
+		static const cpu_kernels k = pick();
+		return k;
+	}
+
+private:
+	static cpu_kernels pick(){
+		__builtin_cpu_init();
+		cpu_kernels k{"sse2" , stream_lines_sse2 , crc32c_table , hash_keys_scalar};
+		if(__builtin_cpu_supports("sse4.2"))
+			k.isa = "sse4.2" , k.crc32c = crc32c_sse42;
+		if(__builtin_cpu_supports("avx2"))
+			k.isa = "avx2" , k.stream_lines = stream_lines_avx2 , k.hash_keys = hash_keys_avx2;
+		if(__builtin_cpu_supports("avx512f"))
+			k.isa = "avx512f" , k.stream_lines = stream_lines_avx512;
+		if(__builtin_cpu_supports("avx512dq"))
+			k.hash_keys = hash_keys_avx512;
+		return k;
+	}
+};
+
+static inline uint32_t crc32c(uint32_t crc , const void * data , size_t n){
+	return cpu_kernels::get().crc32c(crc , data , n);
+}
+
+//hashes of n keys , the same values as hash_bytes_16 one by one
+static inline void hash_bytes_16_n(const char * const * keys , size_t n , uint64_t * out){
+	cpu_kernels::get().hash_keys(keys , n , out);
+}
+
+//copies n bytes , the line aligned middle with streaming stores when
+//there are enough of them and the ragged ends with edge(d , s , n).
+//needs an sfence / pmem_drain before anything that publishes dst
+template<class Edge>
+static inline void stream_copy(void * dst , const void * src , size_t n , Edge edge){
+	static constexpr size_t stream_min = 256;	//below this the cache is cheaper
+	auto d = reinterpret_cast<char *>(dst);
+	auto s = reinterpret_cast<const char *>(src);
+	if(n < stream_min){
+		edge(d , s , n);
+		return;
+	}
+	const size_t head = (64 - (reinterpret_cast<uintptr_t>(d) & 63)) & 63;
+	if(head) edge(d , s , head);
+	d += head , s += head , n -= head;
+	const size_t body = n & ~size_t(63);
+	cpu_kernels::get().stream_lines(d , s , body / 64);
+	if(n > body) edge(d + body , s + body , n - body);
+}
+
+static inline void stream_copy(void * dst , const void * src , size_t n){
+	stream_copy(dst , src , n , [](char * d , const char * s , size_t k){ memcpy(d , s , k); });
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
 
 #define KEY_SIZE 16
 
@@ -60,6 +62,92 @@ private:
     uint64_t _size;
 };
 
+/*
+ *  A value pinned in place: pieces point straight into the engine's storage
+ *  and are only valid while DB::IsPinnedValid holds, so check it again
+ *  after the pieces have been consumed.
+ */
+struct PinnedValue {
+    static const size_t kMaxPieces = 4;
+
+    Slice pieces[kMaxPieces];
+    size_t count = 0;
+    size_t size = 0;
+
+    // engine specific
+    uint32_t id = 0;
+    uint32_t version = 0;
+};
+
+/*
+ *  Shape of a new db file, a field left at 0 is chosen by the engine.
+ *  An existing file keeps the shape it was created with.
+ */
+struct Options {
+    size_t file_size = 0;       // bytes of the pmem file
+    size_t key_area = 0;        // bytes of the file holding keys, the rest holds values
+    size_t partitions = 0;      // writer partitions, one per writing thread is best
+    size_t cache_budget = 0;    // bytes of DRAM read cache including its metadata
+    size_t head_size = 0;       // bytes of pmem per key: 64, 128 or 256, a larger slot keeps
+                                // values of up to (head_size - 64) / 2 bytes next to the key
+    uint32_t compact_interval_ms = 0;   // period of background compaction, 0 to disable
+    uint32_t compress_threshold = 0;    // values this long or longer are stored compressed when
+                                        // it saves space, 0 to disable
+    bool checksum_writes = false;       // a Set writes value and key with one fence, a CRC32C
+                                        // lets recovery tell a torn write
+    uint32_t hot_keys = 0;              // most read keys whose values are kept in a small table
+                                        // checked before the index, at most 1024, 0 to disable
+    bool numa_aware = false;            // spread DRAM tables over the NUMA nodes and give writers
+                                        // partitions of their own node, no-op on one node
+};
+
+/*
+ *  Counters of the value cache since the db was opened.
+ */
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t admitted = 0;      // values read from storage and cached
+    uint64_t rejected = 0;      // values read from storage but not cached
+    uint64_t bytes = 0;         // DRAM in use by the cache, metadata included
+    uint64_t capacity = 0;      // DRAM the cache may use
+    uint64_t hot_hits = 0;      // reads served by the hot table, not counted above
+};
+
+/*
+ *  A key of the hot table with its sampled reads when the table was built.
+ */
+struct HotKey {
+    std::string key;
+    uint64_t reads = 0;
+};
+
+class WriteBatch {
+public:
+    /*
+     *  Buffer key => value in DRAM, nothing is written until DB::Write.
+     *  If a key is put more than once, the last value wins.
+     */
+    void Put(const Slice& key, const Slice& value) {
+        entries_.emplace_back(key.to_string(), value.to_string());
+    }
+
+    void Clear() {
+        entries_.clear();
+    }
+
+    size_t Count() const {
+        return entries_.size();
+    }
+
+    const std::vector<std::pair<std::string, std::string>>& Entries() const {
+        return entries_;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> entries_;
+};
+
 class DB {
 public:
     /*
@@ -71,18 +159,114 @@ public:
      */
     static Status CreateOrOpen(const std::string& name, DB** dbptr, FILE* log_file = nullptr);
 
+    /*
+     *  Same as above, a new file is laid out as options ask.
+     *  IOError is returned if options can not hold any data.
+     */
+    static Status CreateOrOpen(const std::string& name, DB** dbptr, const Options& options, FILE* log_file = nullptr);
+
     /*
      *  Get the value of key.
-     *  If the key does not exist the NotFound is returned.
+     *  If the key does not exist the NotFound is returned, if its value
+     *  is stored damaged the IOError.
      */
     virtual Status Get(const Slice& key, std::string* value) = 0;
 
+    /*
+     *  Get the value of key into buf, *len is set to the length of value.
+     *  If cap is smaller than the value, OutOfMemory is returned and
+     *  nothing is copied.
+     */
+    virtual Status Get(const Slice& key, char* buf, size_t cap, size_t* len) {
+        std::string value;
+        Status sta = Get(key, &value);
+        if (sta != Ok) return sta;
+        *len = value.size();
+        if (value.size() > cap) return OutOfMemory;
+        memcpy(buf, value.data(), value.size());
+        return Ok;
+    }
+
+    /*
+     *  Pin the value of key without copying it.
+     *  Engines that can not pin return IOError, as do values stored compressed.
+     */
+    virtual Status GetPinned(const Slice& key, PinnedValue* pinned) {
+        return IOError;
+    }
+
+    virtual bool IsPinnedValid(const PinnedValue& pinned) {
+        return false;
+    }
+
     /*
      *  Set key to hold the string value.
      *  If key already holds a value, it is overwritten. 
+     *  Values of more than 1KB as stored, after compression, are refused
+     *  with IOError.
      */
     virtual Status Set(const Slice& key, const Slice& value) = 0;
 
+    /*
+     *  Remove key.
+     *  If the key does not exist the NotFound is returned.
+     *  Engines that can not delete return IOError.
+     */
+    virtual Status Delete(const Slice& key) {
+        return IOError;
+    }
+
+    /*
+     *  Get the values of n keys, out[i] holds the status of keys[i].
+     *  Ok is returned only if all of the keys exist.
+     */
+    virtual Status MultiGet(const Slice* keys, size_t n, std::string* values, Status* out) {
+        Status sta = Ok;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = Get(keys[i], &values[i]);
+            if (out[i] != Ok) sta = out[i];
+        }
+        return sta;
+    }
+
+    /*
+     *  Apply all puts of the batch.
+     *  The default implementation is not atomic, engines should override it.
+     */
+    virtual Status Write(const WriteBatch& batch) {
+        for (auto& kv : batch.Entries()) {
+            Slice k(const_cast<char*>(kv.first.data()), kv.first.size());
+            Slice v(const_cast<char*>(kv.second.data()), kv.second.size());
+            Status sta = Set(k, v);
+            if (sta != Ok) return sta;
+        }
+        return Ok;
+    }
+
+    /*
+     *  Engines without a value cache return IOError.
+     */
+    virtual Status GetCacheStats(CacheStats* stats) {
+        return IOError;
+    }
+
+    /*
+     *  Keys in the hot table right now, most read first.
+     *  Engines without a hot table return IOError.
+     */
+    virtual Status GetHotKeys(std::vector<HotKey>* keys) {
+        return IOError;
+    }
+
+    /*
+     *  Move live values so that scattered free space becomes contiguous
+     *  again, one pass. Runs alongside reads and writes.
+     *  Engines without compaction return IOError.
+     */
+    virtual Status Compact() {
+        return IOError;
+    }
+
     /*
      * Close the db on exit.
      */
@@ -0,0 +1,90 @@
+#ifndef FREQUENCY_SKETCH_INCLUDE_H
+#define FREQUENCY_SKETCH_INCLUDE_H
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+#include "utils.hpp"
+
+//TinyLFU admission : a count-min sketch of 4 bit counters , 16 to a word ,
+//each row owning 4 of them. all counters are halved once sample_size
+//increments have been seen , so old popularity fades.
+//updates are relaxed and may be lost under races , which only blurs counts.
+//a saturated counter is not written again , so hot keys cost no stores.
+class frequency_sketch : disable_copy{
+public:
+    static constexpr uint32_t max_count = 15;
+
+public:
+    explicit frequency_sketch(std::size_t capacity)
+    :mask(table_size(capacity) - 1) , sample_size(std::max<std::size_t>(capacity , 16) * 10) ,
+        table(new std::atomic<uint64_t>[mask + 1]){
+        for(std::size_t i = 0 ; i <= mask ; ++i)
+            table[i].store(0 , std::memory_order_relaxed);
+    }
+
+    void record(uint32_t key){
+        bool added = false;
+        for(uint32_t r = 0 ; r < 4 ; ++r){
+            const uint64_t x = uint64_t(key) * seed(r);
+            added |= increment((x >> 32) & mask , (r << 2) | ((x >> 30) & 3));
+        }
+        if(added && size.fetch_add(1 , std::memory_order_relaxed) + 1 == sample_size)
+            reset();
+    }
+
+    uint32_t frequency(uint32_t key) const{
+        uint32_t freq = max_count;
+        for(uint32_t r = 0 ; r < 4 ; ++r){
+            const uint64_t x = uint64_t(key) * seed(r);
+            const uint64_t word = table[(x >> 32) & mask].load(std::memory_order_relaxed);
+            freq = std::min<uint32_t>(freq , (word >> (((r << 2) | ((x >> 30) & 3)) << 2)) & 0xf);
+        }
+        return freq;
+    }
+
+    //candidate takes the place of victim only if it is seen more often
+    bool admit(uint32_t candidate , uint32_t victim) const{
+        return frequency(candidate) > frequency(victim);
+    }
+
+private:
+
+    static std::size_t table_size(std::size_t capacity){
+        std::size_t sz = 16;
+        while(sz < capacity) sz <<= 1;
+        return sz;
+    }
+
+    static uint64_t seed(uint32_t r){
+        static constexpr uint64_t seeds[4] = {
+            0x9e3779b97f4a7c15ull , 0xc2b2ae3d27d4eb4full , 0x165667b19e3779f9ull , 0xd6e8feb86659fd93ull
+        };
+        return seeds[r];
+    }
+
+    bool increment(std::size_t i , uint32_t nibble){
+        const uint32_t shift = nibble << 2;
+        uint64_t word = table[i].load(std::memory_order_relaxed);
+        while(((word >> shift) & 0xf) != max_count){
+            if(table[i].compare_exchange_weak(word , word + (1ull << shift) , std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    void reset(){
+        for(std::size_t i = 0 ; i <= mask ; ++i)
+            table[i].store((table[i].load(std::memory_order_relaxed) >> 1) & 0x7777777777777777ull , std::memory_order_relaxed);
+        size.store(sample_size / 2 , std::memory_order_relaxed);
+    }
+
+private:
+    const std::size_t mask;
+    const std::size_t sample_size;
+    std::unique_ptr<std::atomic<uint64_t>[]> table;
+    std::atomic<std::size_t> size{0};
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef GROUP_HASH_INCLUDE_H
+#define GROUP_HASH_INCLUDE_H
+
+#include <memory>
+#include <atomic>
+#include <cstring>
+
+#include "utils.hpp"
+
+//swiss-table style open addressing : 1-byte hash tags in a control array ,
+//probed 32 slots at a time , key_index in a separate slot array.
+//same interface as open_address_hash , prefix is not used.
+class group_address_hash{
+public:
+    static constexpr uint32_t group_size = 32;
+    static constexpr uint32_t null_id = 0xffffffff;
+    static constexpr uint32_t kind = 2;     //checkpoint format
+
+private:
+
+    static constexpr uint32_t deleted_id = 0xfffffffe;
+    static constexpr uint8_t empty_ctrl = 0x80;
+    static constexpr uint8_t deleted_ctrl = 0xfe;
+    static constexpr uint8_t busy_ctrl = 0xfd;       //claimed , key_index not published yet
+
+public:
+
+    explicit group_address_hash(uint32_t n) noexcept
+    :n_group((n + group_size - 1) / group_size) , n_bucket(n_group * group_size){
+        auto c = new uint8_t[n_bucket];
+        auto s = new uint32_t[n_bucket];
+        memset(c , empty_ctrl , sizeof(uint8_t) * n_bucket);
+        memset(s , 0xff , sizeof(uint32_t) * n_bucket);
+
+        ctrl.reset(reinterpret_cast<std::atomic<uint8_t>*>(c));
+        slot.reset(reinterpret_cast<std::atomic<uint32_t>*>(s));
+    }
+
+    void insert(uint64_t hash , uint32_t prefix , uint32_t key_index){
+        UNUSED(prefix);
+        const uint8_t tag = tag_of(hash);
+
+        for(uint32_t g = home(hash) , cnt = 0 ; cnt < n_group ; ++cnt , g = next(g)){
+            auto group = load_group(g);
+            //ctrl is claimed first , busy is occupied to lookups , so a probe
+            //never stops at a slot whose insert is still under way
+            uint32_t vacant = match(group , empty_ctrl) | match(group , deleted_ctrl);
+            for(; vacant ; vacant &= vacant - 1){
+                const uint32_t i = g * group_size + __builtin_ctz(vacant);
+                uint8_t cur = ctrl[i].load(std::memory_order_relaxed);
+                if(cur != empty_ctrl && cur != deleted_ctrl) continue;
+                if(ctrl[i].compare_exchange_strong(
+                    cur , busy_ctrl ,
+                    std::memory_order_relaxed ,
+                    std::memory_order_relaxed)){
+                    slot[i].store(key_index , std::memory_order_relaxed);
+                    ctrl[i].store(tag , std::memory_order_release);
+                    return;
+                }
+            }
+        }
+    }
+
+    template<class F>
+    uint32_t search(uint64_t hash , uint32_t prefix , F && key_cmp_eq){
+        UNUSED(prefix);
+        const uint8_t tag = tag_of(hash);
+
+        for(uint32_t g = home(hash) , cnt = 0 ; cnt < n_group ; ++cnt , g = next(g)){
+            auto group = load_group(g);
+            for(uint32_t hit = match(group , tag) ; hit ; hit &= hit - 1){
+                const uint32_t key_id = slot[g * group_size + __builtin_ctz(hit)].load(std::memory_order_relaxed);
+                if(key_id < deleted_id && key_cmp_eq(key_id)) return key_id;
+            }
+            if(match(group , empty_ctrl)) break;
+        }
+        return null_id;
+    }
+
+    //returns the erased key_index
+    template<class F>
+    uint32_t erase(uint64_t hash , uint32_t prefix , F && key_cmp_eq){
+        UNUSED(prefix);
+        const uint8_t tag = tag_of(hash);
+
+        for(uint32_t g = home(hash) , cnt = 0 ; cnt < n_group ; ++cnt , g = next(g)){
+            auto group = load_group(g);
+            for(uint32_t hit = match(group , tag) ; hit ; hit &= hit - 1){
+                const uint32_t i = g * group_size + __builtin_ctz(hit);
+                uint32_t key_id = slot[i].load(std::memory_order_relaxed);
+                if(key_id >= deleted_id || !key_cmp_eq(key_id)) continue;
+                //slot first , a matching tag then reads deleted_id until ctrl
+                //says deleted and the slot can be claimed again
+                if(slot[i].compare_exchange_strong(
+                    key_id , deleted_id ,
+                    std::memory_order_relaxed ,
+                    std::memory_order_relaxed)){
+                    ctrl[i].store(deleted_ctrl , std::memory_order_release);
+                    return key_id;
+                }
+            }
+            if(match(group , empty_ctrl)) break;
+        }
+        return null_id;
+    }
+
+    void prefetch(uint64_t hash) const{
+        const uint32_t g = home(hash);
+        prefetch_t0(&ctrl[g * group_size]);
+        prefetch_t0(&slot[g * group_size]);
+    }
+
+    //first key_index in the probe chain whose tag matches , without comparing keys
+    uint32_t peek(uint64_t hash , uint32_t prefix) const{
+        UNUSED(prefix);
+        const uint8_t tag = tag_of(hash);
+
+        for(uint32_t g = home(hash) , cnt = 0 ; cnt < n_group ; ++cnt , g = next(g)){
+            auto group = load_group(g);
+            for(uint32_t hit = match(group , tag) ; hit ; hit &= hit - 1){
+                const uint32_t key_id = slot[g * group_size + __builtin_ctz(hit)].load(std::memory_order_relaxed);
+                if(key_id < deleted_id) return key_id;
+            }
+            if(match(group , empty_ctrl)) break;
+        }
+        return null_id;
+    }
+
+    bool dump(FILE * f) const{
+        return dump_pod(f , reinterpret_cast<const uint8_t *>(ctrl.get()) , n_bucket)
+            && dump_pod(f , reinterpret_cast<const uint32_t *>(slot.get()) , n_bucket);
+    }
+
+    bool load(FILE * f){
+        return load_pod(f , reinterpret_cast<uint8_t *>(ctrl.get()) , n_bucket)
+            && load_pod(f , reinterpret_cast<uint32_t *>(slot.get()) , n_bucket);
+    }
+
+    //not thread safe
+    void clear(){
+        memset(reinterpret_cast<uint8_t *>(ctrl.get()) , empty_ctrl , sizeof(uint8_t) * n_bucket);
+        memset(reinterpret_cast<uint32_t *>(slot.get()) , 0xff , sizeof(uint32_t) * n_bucket);
+    }
+
+    uint32_t size() const{
+        return n_bucket;
+    }
+
+private:
+
+    //the home group comes from the high bits , the tag from the 7 low ones
+    uint32_t home(uint64_t hash) const{
+        return fast_range(hash , n_group);
+    }
+
+    uint32_t next(uint32_t g) const{
+        return ++g == n_group ? 0 : g;
+    }
+
+    static uint8_t tag_of(uint64_t hash){
+        return hash & 0x7f;
+    }
+
+    //two SSE2 halves , so the index runs on hosts without AVX2
+    struct ctrl_group{
+        __m128i lo , hi;
+    };
+
+    ctrl_group load_group(uint32_t g) const{
+        auto p = reinterpret_cast<const __m128i *>(&ctrl[g * group_size]);
+        ctrl_group group{_mm_loadu_si128(p) , _mm_loadu_si128(p + 1)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return group;
+    }
+
+    static uint32_t match(const ctrl_group & group , uint8_t c){
+        const __m128i v = _mm_set1_epi8(c);
+        return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group.lo , v)))
+            | uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group.hi , v))) << 16;
+    }
+
+private:
+    const uint32_t n_group;
+    const uint32_t n_bucket;
+    std::unique_ptr<std::atomic<uint8_t>[]> ctrl{};
+    std::unique_ptr<std::atomic<uint32_t>[]> slot{};
+};
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef GROWABLE_HASH_INCLUDE_H
+#define GROWABLE_HASH_INCLUDE_H
+
+#include <memory>
+#include <atomic>
+#include <numeric>
+#include <cstring>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "rcu_ptr.hpp"
+
+//open addressing index which starts small and doubles up to max_capacity buckets.
+//a full table gets a successor , inserting and reading threads migrate it
+//chunk by chunk : a slot is copied to the successor and then frozen as moved ,
+//so an entry is always reachable by walking the chain of tables from cur.
+//every operation is a reader of an rcu_domain , a table left behind by cur
+//is retired and freed by the next operation once no reader can hold it.
+//same interface as open_address_hash , the high half of the hash replaces prefix.
+class growable_hash{
+public:
+    static constexpr uint32_t null_id = 0xffffffff;
+    static constexpr uint32_t kind = 3;     //checkpoint format
+
+private:
+
+    using bucket_type = uint64_t;
+    static constexpr uint64_t null_bucket = std::numeric_limits<uint64_t>::max();
+    static constexpr uint64_t deleted_bucket = null_bucket - (1ull << 32);
+    static constexpr uint64_t moved_bucket = null_bucket - (2ull << 32);
+    static constexpr uint32_t chunk_size = 4096;
+    static constexpr std::size_t n_stripe = 16;
+
+    struct table{
+        const uint32_t capacity;
+        const uint32_t n_chunk;
+        std::unique_ptr<std::atomic<bucket_type>[]> bucket;
+        std::atomic<uint32_t> used{0};          //slots ever taken , erased ones included
+        std::atomic<table *> next{nullptr};
+        std::atomic<uint32_t> claimed{0};       //chunks handed out for migration
+        std::atomic<uint32_t> migrated{0};      //chunks done
+        table * retired_next{nullptr};
+
+        explicit table(uint32_t cap)
+        :capacity(cap) , n_chunk((cap + chunk_size - 1) / chunk_size){
+            auto p = new bucket_type[cap];
+            memset(p , 0xff , sizeof(bucket_type) * cap);
+            bucket.reset(reinterpret_cast<std::atomic<bucket_type>*>(p));
+        }
+
+        uint32_t home(uint32_t tag) const{
+            return (uint64_t(tag) * capacity) >> 32;
+        }
+    };
+
+    enum class put_result{ ok , full , moved };
+
+public:
+
+    explicit growable_hash(uint32_t max_capacity , uint32_t init_capacity = 1 << 16) noexcept
+    :max_capacity(max_capacity) , init_capacity(std::min(init_capacity , max_capacity)) , cur(new_table(this->init_capacity)){
+    }
+
+    ~growable_hash(){
+        release();
+    }
+
+    growable_hash(const growable_hash &) = delete;
+    growable_hash & operator = (const growable_hash &) = delete;
+
+    void insert(uint64_t hash , uint32_t prefix , uint32_t key_index){
+        UNUSED(prefix);
+        {
+            reader guard(domain , reader_stripe());
+            put(cur.load(std::memory_order_acquire) , make_bucket(hash , key_index));
+        }
+        reclaim();
+    }
+
+    template<class F>
+    uint32_t search(uint64_t hash , uint32_t prefix , F && key_cmp_eq){
+        UNUSED(prefix);
+        uint32_t key_id = null_id;
+        {
+            reader guard(domain , reader_stripe());
+            key_id = search_chain(hash >> 32 , key_cmp_eq);
+        }
+        reclaim();
+        return key_id;
+    }
+
+    //returns the erased key_index
+    template<class F>
+    uint32_t erase(uint64_t hash , uint32_t prefix , F && key_cmp_eq){
+        UNUSED(prefix);
+        reader guard(domain , reader_stripe());
+        const uint32_t tag = hash >> 32;
+        for(table * t = cur.load(std::memory_order_acquire) ; t ; t = t->next.load(std::memory_order_acquire)){
+            for(uint32_t i = t->home(tag) , cnt = 0 ; cnt < t->capacity ; ++cnt , i = next_slot(t , i)){
+                uint64_t n = t->bucket[i].load(std::memory_order_acquire);
+                if(n == null_bucket) break;
+                if(n == deleted_bucket || n == moved_bucket || tag_of(n) != tag) continue;
+                //a frozen copy in the old table fails this cas , the copy is then erased in the next one
+                if(key_cmp_eq(index_of(n)) && t->bucket[i].compare_exchange_strong(
+                    n , deleted_bucket ,
+                    std::memory_order_release ,
+                    std::memory_order_relaxed))
+                    return index_of(n);
+            }
+        }
+        return null_id;
+    }
+
+    void prefetch(uint64_t hash){
+        reader guard(domain , reader_stripe());
+        table * t = cur.load(std::memory_order_acquire);
+        prefetch_t0(&t->bucket[t->home(hash >> 32)]);
+    }
+
+    //first key_index in the probe chain whose tag matches , without comparing keys
+    uint32_t peek(uint64_t hash , uint32_t prefix){
+        UNUSED(prefix);
+        reader guard(domain , reader_stripe());
+        const uint32_t tag = hash >> 32;
+        for(table * t = cur.load(std::memory_order_acquire) ; t ; t = t->next.load(std::memory_order_acquire)){
+            auto key_id = search_in(t , tag , [](uint32_t){ return true; });
+            if(key_id != null_id) return key_id;
+        }
+        return null_id;
+    }
+
+    uint32_t capacity(){
+        reader guard(domain , reader_stripe());
+        table * t = cur.load(std::memory_order_acquire);
+        while(table * n = t->next.load(std::memory_order_acquire)) t = n;
+        return t->capacity;
+    }
+
+    //bytes of all tables not freed yet
+    std::size_t memory_size() const{
+        return bytes.load(std::memory_order_relaxed);
+    }
+
+    //not thread safe , finishes a pending migration first
+    bool dump(FILE * f){
+        table * t = cur.load(std::memory_order_acquire);
+        while(table * n = t->next.load(std::memory_order_acquire)){
+            help_migrate(t , t->n_chunk);
+            t = n;
+        }
+        reclaim();
+        const uint32_t used = t->used.load(std::memory_order_relaxed);
+        return dump_pod(f , &t->capacity) && dump_pod(f , &used)
+            && dump_pod(f , reinterpret_cast<const bucket_type *>(t->bucket.get()) , t->capacity);
+    }
+
+    //not thread safe
+    bool load(FILE * f){
+        uint32_t cap{} , used{};
+        if(!load_pod(f , &cap) || !load_pod(f , &used) || cap == 0 || cap > max_capacity)
+            return false;
+        table * t = new_table(cap);
+        if(!load_pod(f , reinterpret_cast<bucket_type *>(t->bucket.get()) , cap)){
+            free_table(t);
+            return false;
+        }
+        t->used.store(used , std::memory_order_relaxed);
+
+        release();
+        cur.store(t , std::memory_order_release);
+        return true;
+    }
+
+    //not thread safe , back to one table of the initial capacity
+    void clear(){
+        release();
+        cur.store(new_table(init_capacity) , std::memory_order_release);
+    }
+
+private:
+    using reader = rcu_domain<n_stripe>::reader;
+
+    static uint32_t reader_stripe(){
+        return rcu_domain<n_stripe>::thread_stripe();
+    }
+
+    table * new_table(uint32_t cap){
+        bytes.fetch_add(sizeof(table) + sizeof(bucket_type) * cap , std::memory_order_relaxed);
+        return new table(cap);
+    }
+
+    void free_table(table * t){
+        bytes.fetch_sub(sizeof(table) + sizeof(bucket_type) * t->capacity , std::memory_order_relaxed);
+        delete t;
+    }
+
+    //not thread safe
+    void release(){
+        for(table * t = cur.load(std::memory_order_relaxed) ; t ; ){
+            table * n = t->next.load(std::memory_order_relaxed);
+            free_table(t);
+            t = n;
+        }
+        free_retired(retired.exchange(nullptr , std::memory_order_relaxed));
+    }
+
+    void free_retired(table * t){
+        while(t){
+            table * n = t->retired_next;
+            free_table(t);
+            t = n;
+        }
+    }
+
+    //by a thread that is no reader , tables retired so far wait for the
+    //readers that may still walk them
+    void reclaim(){
+        if(likely(!retired.load(std::memory_order_relaxed)))
+            return;
+        table * t = retired.exchange(nullptr , std::memory_order_acquire);
+        if(!t)
+            return;
+        domain.synchronize();
+        free_retired(t);
+    }
+
+    template<class F>
+    uint32_t search_chain(uint32_t tag , F && key_cmp_eq){
+        for(table * t = cur.load(std::memory_order_acquire) ; t ; t = t->next.load(std::memory_order_acquire)){
+            if(unlikely(t->next.load(std::memory_order_relaxed) != nullptr))
+                help_migrate(t , 1);
+            auto key_id = search_in(t , tag , key_cmp_eq);
+            if(key_id != null_id) return key_id;
+        }
+        return null_id;
+    }
+
+    static uint64_t make_bucket(uint64_t hash , uint32_t key_index){
+        return (uint64_t(key_index) << 32) | (hash >> 32);
+    }
+
+    static uint32_t tag_of(uint64_t n){
+        return static_cast<uint32_t>(n);
+    }
+
+    static uint32_t index_of(uint64_t n){
+        return static_cast<uint32_t>(n >> 32);
+    }
+
+    static uint32_t next_slot(const table * t , uint32_t i){
+        return ++i == t->capacity ? 0 : i;
+    }
+
+    template<class F>
+    static uint32_t search_in(const table * t , uint32_t tag , F && key_cmp_eq){
+        for(uint32_t i = t->home(tag) , cnt = 0 ; cnt < t->capacity ; ++cnt , i = next_slot(t , i)){
+            uint64_t n = t->bucket[i].load(std::memory_order_acquire);
+            if(n == null_bucket) break;
+            if(n == deleted_bucket || n == moved_bucket || tag_of(n) != tag) continue;
+            if(key_cmp_eq(index_of(n))) return index_of(n);
+        }
+        return null_id;
+    }
+
+    //insert into the newest table reachable from t
+    void put(table * t , uint64_t n){
+        for(;;){
+            if(table * next = t->next.load(std::memory_order_acquire)){
+                help_migrate(t , 1);
+                t = next;
+                continue;
+            }
+
+            if(t->used.load(std::memory_order_relaxed) >= t->capacity / 2 && t->capacity < max_capacity){
+                grow(t);
+                continue;
+            }
+
+            switch(put_in(t , n)){
+            case put_result::ok :
+                return;
+            case put_result::full :
+                if(t->capacity == max_capacity) return;    //as open_address_hash , give up
+                grow(t);
+                break;
+            case put_result::moved :
+                break;
+            }
+        }
+    }
+
+    static put_result put_in(table * t , uint64_t n){
+        for(uint32_t i = t->home(tag_of(n)) , cnt = 0 ; cnt < t->capacity ; ++cnt , i = next_slot(t , i)){
+            uint64_t old = t->bucket[i].load(std::memory_order_relaxed);
+            while(old == null_bucket || old == deleted_bucket){
+                if(t->bucket[i].compare_exchange_weak(
+                    old , n ,
+                    std::memory_order_release ,
+                    std::memory_order_relaxed)){
+                    if(old == null_bucket) t->used.fetch_add(1 , std::memory_order_relaxed);
+                    return put_result::ok;
+                }
+            }
+            if(old == moved_bucket) return put_result::moved;
+        }
+        return put_result::full;
+    }
+
+    void grow(table * t){
+        auto cap = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(t->capacity) * 2 , max_capacity));
+        auto n = new_table(cap);
+        table * expected = nullptr;
+        if(!t->next.compare_exchange_strong(expected , n , std::memory_order_acq_rel))
+            free_table(n);
+    }
+
+    //migrate at most max_chunk chunks of t into its successor
+    void help_migrate(table * t , uint32_t max_chunk){
+        table * n = t->next.load(std::memory_order_acquire);
+        for(uint32_t k = 0 ; k < max_chunk ; ++k){
+            uint32_t c = t->claimed.fetch_add(1 , std::memory_order_relaxed);
+            if(c >= t->n_chunk) return;
+
+            const uint32_t end = std::min(t->capacity , (c + 1) * chunk_size);
+            for(uint32_t i = c * chunk_size ; i < end ; ++i)
+                migrate_slot(t , n , i);
+
+            if(t->migrated.fetch_add(1 , std::memory_order_seq_cst) + 1 == t->n_chunk)
+                advance(t);
+        }
+    }
+
+    //cur moves past t once it is migrated. a successor may finish before t
+    //does , its own cas then fails and it is stepped over here
+    void advance(table * t){
+        table * expected = t;
+        while(cur.compare_exchange_strong(expected , t->next.load(std::memory_order_relaxed) , std::memory_order_seq_cst)){
+            retire(t);
+            t = t->next.load(std::memory_order_relaxed);
+            if(!t->next.load(std::memory_order_acquire) || t->migrated.load(std::memory_order_seq_cst) != t->n_chunk)
+                return;
+            expected = t;
+        }
+    }
+
+    void migrate_slot(table * t , table * n , uint32_t i){
+        uint64_t v = t->bucket[i].load(std::memory_order_acquire);
+        for(;;){
+            if(v == null_bucket || v == deleted_bucket){
+                if(t->bucket[i].compare_exchange_weak(v , moved_bucket , std::memory_order_release , std::memory_order_acquire))
+                    return;
+                continue;
+            }
+
+            //copy , then freeze
+            put(n , v);
+            uint64_t expected = v;
+            if(t->bucket[i].compare_exchange_strong(expected , moved_bucket , std::memory_order_release , std::memory_order_acquire))
+                return;
+
+            //erased meanwhile , drop the copy
+            remove_exact(n , v);
+            v = expected;
+        }
+    }
+
+    //unlinked from cur , readers that loaded it before may still walk it
+    void retire(table * t){
+        table * head = retired.load(std::memory_order_relaxed);
+        do{
+            t->retired_next = head;
+        }while(!retired.compare_exchange_weak(head , t , std::memory_order_release , std::memory_order_relaxed));
+    }
+
+    static void remove_exact(table * t , uint64_t v){
+        for(; t ; t = t->next.load(std::memory_order_acquire)){
+            for(uint32_t i = t->home(tag_of(v)) , cnt = 0 ; cnt < t->capacity ; ++cnt , i = next_slot(t , i)){
+                uint64_t n = t->bucket[i].load(std::memory_order_acquire);
+                if(n == null_bucket) break;
+                if(n == v && t->bucket[i].compare_exchange_strong(n , deleted_bucket , std::memory_order_release , std::memory_order_relaxed))
+                    return;
+            }
+        }
+    }
+
+private:
+    const uint32_t max_capacity;
+    const uint32_t init_capacity;
+    std::atomic<std::size_t> bytes{0};
+    std::atomic<table *> cur;
+    std::atomic<table *> retired{nullptr};      //by retired_next
+    rcu_domain<n_stripe> domain;
+};
+
+#endif
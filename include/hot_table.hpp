@@ -0,0 +1,159 @@
+#ifndef HOT_TABLE_INCLUDE_H
+#define HOT_TABLE_INCLUDE_H
+
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "utils.hpp"
+
+//top-K of sampled reads , space-saving : a key not tracked takes the place
+//of the least counted one and inherits its count , so every key read more
+//than total / capacity times is tracked. counts are over-estimates by at
+//most the inherited part. items form a min-heap on count with their
+//positions indexed by key , a sample costs O(log capacity).
+//not thread safe , fed by one thread.
+class space_saving : disable_copy{
+public:
+    struct item{
+        uint32_t key_index;
+        uint32_t count;
+    };
+
+    explicit space_saving(std::size_t capacity)
+    :capacity(std::max<std::size_t>(capacity , 1)){
+        items.reserve(this->capacity);
+        where.reserve(this->capacity * 2);
+    }
+
+    void record(uint32_t key_index){
+        auto it = where.find(key_index);
+        if(it != where.end()){
+            ++items[it->second].count;
+            sift_down(it->second);
+        }else if(items.size() < capacity){
+            where[key_index] = items.size();
+            items.push_back(item{key_index , 1});
+            sift_up(items.size() - 1);
+        }else{
+            where.erase(items[0].key_index);
+            where[key_index] = 0;
+            items[0] = item{key_index , items[0].count + 1};
+            sift_down(0);
+        }
+    }
+
+    //the n most counted , most first. counts are halved , so keys that
+    //cooled down leave within a few rounds. halving keeps the heap order
+    std::vector<item> top(std::size_t n){
+        std::vector<item> out = items;
+        std::sort(out.begin() , out.end() , [](const item & l , const item & r){ return l.count > r.count; });
+        out.resize(std::min(n , out.size()));
+        for(auto & i : items)
+            i.count >>= 1;
+        return out;
+    }
+
+private:
+    void place(std::size_t pos , const item & i){
+        items[pos] = i;
+        where[i.key_index] = pos;
+    }
+
+    void sift_up(std::size_t pos){
+        const item i = items[pos];
+        while(pos && items[(pos - 1) / 2].count > i.count){
+            place(pos , items[(pos - 1) / 2]);
+            pos = (pos - 1) / 2;
+        }
+        place(pos , i);
+    }
+
+    void sift_down(std::size_t pos){
+        const item i = items[pos];
+        for(;;){
+            std::size_t child = pos * 2 + 1;
+            if(child >= items.size()) break;
+            if(child + 1 < items.size() && items[child + 1].count < items[child].count) ++child;
+            if(items[child].count >= i.count) break;
+            place(pos , items[child]);
+            pos = child;
+        }
+        place(pos , i);
+    }
+
+private:
+    const std::size_t capacity;
+    std::vector<item> items;                            //min-heap on count
+    std::unordered_map<uint32_t , std::size_t> where;   //key_index => position in items
+};
+
+//values of the hottest keys copied into one small block , built once and
+//then only read. an entry is good while ver_seq of its key still equals ver
+class hot_table : disable_copy{
+public:
+    static constexpr uint32_t max_value = 1_KB;
+
+    struct entry{
+        char key[16];
+        uint32_t key_index;
+        uint32_t ver;
+        uint32_t len;
+        uint32_t off;       //in values
+        uint64_t count;     //sampled reads when it was built
+    };
+
+public:
+
+    //false if the value is too long
+    bool add(const char * key , uint32_t key_index , uint32_t ver , uint64_t count , const char * value , uint32_t len){
+        if(len > max_value)
+            return false;
+        entry e{};
+        memcpy_avx_16(e.key , key);
+        e.key_index = key_index , e.ver = ver , e.len = len , e.off = values.size() , e.count = count;
+        entries.push_back(e);
+        values.append(value , len);
+        return true;
+    }
+
+    //slots of at most half load , entry ids by the low bits of the hash
+    void seal(){
+        std::size_t n = 8;
+        while(n < entries.size() * 2) n <<= 1;
+        slots.assign(n , uint16_t(empty));
+        for(uint16_t i = 0 ; i < entries.size() ; ++i){
+            std::size_t s = hash_bytes_16(entries[i].key) & (n - 1);
+            while(slots[s] != empty)
+                s = (s + 1) & (n - 1);
+            slots[s] = i;
+        }
+    }
+
+    const entry * find(const char * key , uint64_t hash) const{
+        const std::size_t mask = slots.size() - 1;
+        for(std::size_t s = hash & mask ; slots[s] != empty ; s = (s + 1) & mask)
+            if(fast_key_cmp_eq(entries[slots[s]].key , key))
+                return &entries[slots[s]];
+        return nullptr;
+    }
+
+    const char * value(const entry & e) const{
+        return values.data() + e.off;
+    }
+
+    const std::vector<entry> & all() const{
+        return entries;
+    }
+
+private:
+    static constexpr uint16_t empty = 0xffff;
+
+    std::vector<entry> entries{};
+    std::vector<uint16_t> slots{};
+    std::string values{};
+};
+
+#endif
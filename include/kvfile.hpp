@@ -9,14 +9,54 @@
 #include "db.hpp"
 #include "utils.hpp"
 
+//a value is one run of blocks from [0] , marked by BLOCK_RUN in [1].
+//[2] of a run holds the bytes stored when the value is compressed , else 0.
+//a small value may sit in its own key slot instead , marked by BLOCK_INLINE
+//in [1] with the key in [0] and the copy of the slot in [2].
+//[3] of either holds the CRC32C of the copy when its head has HEAD_CRC.
+//files written before runs hold up to 4 scattered 256B / 128B pieces
 struct block_index
 : std::array<uint32_t , 4>{};
 
+static constexpr uint32_t BLOCK_RUN = 0xfffffffe;
+static constexpr uint32_t BLOCK_INLINE = 0xfffffffd;
+
+static inline bool is_block_run(const block_index & block){
+    return block[1] == BLOCK_RUN;
+}
+
+static inline bool is_inline(const block_index & block){
+    return block[1] == BLOCK_INLINE;
+}
+
+static inline bool is_packed(const block_index & block){
+    return is_block_run(block) && block[2];
+}
+
+//bytes laid in the blocks of a value of len bytes
+static inline uint32_t stored_len(const block_index & block , uint32_t len){
+    return is_packed(block) ? block[2] : len;
+}
+
+//blocks of a value of len bytes
+static inline uint32_t run_blocks(uint32_t len){
+    return len ? (len + 127) >> 7 : 1;
+}
+
+//head_info::flags
+static constexpr uint8_t HEAD_NEW_KEY = 0x01;     //appended by a batch
+static constexpr uint8_t HEAD_TOMBSTONE = 0x02;   //deleted , slot can be reused
+static constexpr uint8_t HEAD_CRC = 0x04;         //written with its value in one fence
+
 struct alignas(CACHELINE_SIZE) head_info{
     char key[KEY_SIZE];
     bool index_flag;
-    uint32_t value_len;
+    uint8_t batch_owner;    //bucket which wrote the batch
+    uint8_t flags;
+    uint32_t value_len;     //as written by the user , see stored_len
     block_index index[2];
+    uint32_t batch_seq;     //0 if not written by a batch
+    uint32_t prev_len;      //value_len before the batch or checksummed write , for rollback
 };
 
 struct value_block
@@ -25,33 +65,53 @@ struct value_block
 struct meta_info 
 : std::array<char , 1_KB>{};
 
-template<
-    std::size_t n_key_head, 
-    std::size_t n_value_block>
+//[ key slots | value blocks (256B aligned) | ... | meta (last 1KB) ]
+//a key slot is a head , followed by two copies of an inline value when
+//slots are larger than a head
 class kv_file_info{
     void * pbase;
+    char * key_slots;
+    size_t slot_size;
 public :
-    head_info * key_heads;
     value_block * value_blocks;
-    // meta_info * meta;
+    meta_info * meta;
 
 public:
 
     kv_file_info() = default;
 
-    explicit kv_file_info(void * base , size_t sz) noexcept
-    : pbase(base) {
-        constexpr auto key_sz = sizeof(head_info) * n_key_head  , value_sz = sizeof(value_block) * n_value_block;
+    explicit kv_file_info(void * base , size_t sz , size_t n_key_head , size_t n_value_block , size_t slot_size = sizeof(head_info)) noexcept
+    : pbase(base) , slot_size(slot_size) {
+        const auto key_sz = slot_size * n_key_head  , value_sz = sizeof(value_block) * n_value_block;
 
-        key_heads = reinterpret_cast<head_info*>(base) ; //reinterpret_cast<head_info *>(align(sizeof(head_info) , key_sz , base , sz));
+        meta = reinterpret_cast<meta_info *>((char *)base + sz - sizeof(meta_info));
+        key_slots = reinterpret_cast<char *>(base) ;
         base = (char *)base + key_sz , sz -= key_sz;
-        value_blocks = reinterpret_cast<value_block *>(align(256, value_sz, base,sz));
-        if(!key_heads || !value_blocks ) perror("align failed.") , exit(0);
+        value_blocks = reinterpret_cast<value_block *>(align(256, value_sz + sizeof(meta_info), base,sz));
+        if(!key_slots || !value_blocks ) perror("align failed.") , exit(0);
     }
 
     void * base() const{
         return pbase;
     }
+
+    head_info & key_head(size_t key_index) const{
+        return *reinterpret_cast<head_info *>(key_slots + key_index * slot_size);
+    }
+
+    //bytes of one inline copy , 0 if slots hold no values
+    size_t inline_cap() const{
+        return (slot_size - sizeof(head_info)) / 2;
+    }
+
+    char * inline_value(size_t key_index , uint32_t copy) const{
+        return key_slots + key_index * slot_size + sizeof(head_info) + copy * inline_cap();
+    }
+
+    //offset of the value area for n_key_head slots
+    static constexpr size_t value_offset(size_t n_key_head , size_t slot_size = sizeof(head_info)){
+        return (slot_size * n_key_head + 255) / 256 * 256;
+    }
 };
 
 static_assert(sizeof(head_info) == 64  && sizeof(value_block) == 128 && sizeof(block_index) == 16, "");
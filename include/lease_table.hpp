@@ -0,0 +1,61 @@
+#ifndef LEASE_TABLE_INCLUDE_H
+#define LEASE_TABLE_INCLUDE_H
+
+#include <atomic>
+#include <memory>
+
+#include "utils.hpp"
+
+//exclusive ownership of writer partitions.
+//shared by the engine and the threads holding a lease , so a thread
+//exiting after the engine is closed still finds it.
+class lease_table : disable_copy{
+public:
+    static constexpr uint32_t null_id = 0xffffffff;
+
+public:
+    explicit lease_table(uint32_t n)
+    :n(n) , owner(new atomic_uint_align64_t[n]()){
+    }
+
+    //first free partition from hint on
+    uint32_t try_acquire(uint32_t hint){
+        return try_acquire(hint , 0 , n);
+    }
+
+    //same , within [beg , end)
+    uint32_t try_acquire(uint32_t hint , uint32_t beg , uint32_t end){
+        const uint32_t len = end - beg;
+        for(uint32_t i = 0 , off = len ? hint % len : 0 ; i < len ; ++i , off = (off + 1 == len ? 0 : off + 1)){
+            if(try_lock(beg + off)) return beg + off;
+        }
+        return null_id;
+    }
+
+    bool try_lock(uint32_t id){
+        uint32_t expected = 0;
+        return owner[id].load(std::memory_order_relaxed) == 0
+            && owner[id].compare_exchange_strong(
+                expected , 1 ,
+                std::memory_order_acquire ,
+                std::memory_order_relaxed);
+    }
+
+    void release(uint32_t id){
+        owner[id].store(0 , std::memory_order_release);
+    }
+
+    bool is_leased(uint32_t id) const{
+        return owner[id].load(std::memory_order_relaxed) != 0;
+    }
+
+    uint32_t size() const{
+        return n;
+    }
+
+private:
+    const uint32_t n;
+    std::unique_ptr<atomic_uint_align64_t[]> owner;
+};
+
+#endif
@@ -1,90 +1,209 @@
 #ifndef LRU_CACHE_INCLUDE_H
 #define LRU_CACHE_INCLUDE_H
 
-#include <vector>
-#include <unordered_map>
 #include <memory>
+#include <cstring>
+#include <functional>
+#include <algorithm>
 #include "utils.hpp"
 
-template <class K, class T>
-struct Node{
-    K key;
-    T data;
-    Node *prev, *next;
-};
-
-template <class K, class T , std::size_t size>
+//not thread safe.
+//values of up to max_chunk * chunk_size bytes are stored inline in 128B chunks ,
+//a value takes as many as its size needs , like value blocks in the file.
+//nodes and chunks are carved once from slabs and kept on intrusive free lists ,
+//keys are found through an open addressing table of node ids.
+//nothing is allocated after construction and a miss writes nothing.
+template <class K, class M>
 class alignas(CACHELINE_SIZE) lru_cache{
 public:
-    lru_cache(){
-        auto p = new Node<K,T>[size];
-        entries_.reset(p);
-        hashmap_.reserve(size);
-        free_entries_.resize(size);
-        for(uint i=0; i<size; ++i)
-            free_entries_[i] = p + i;
-        head_.prev = nullptr;
-        head_.next = &tail_;
-        tail_.prev = &head_;
-        tail_.next = nullptr;
-
-    }
-
-    void put(K key, T && data){
-        auto *node = hashmap_[key];
-        if(node){ // node exists
-            detach(node);
-            node->data = std::move(data);
-            attach(node);
+    static constexpr uint32_t chunk_size = 128;
+    static constexpr uint32_t max_chunk = 8;
+    static constexpr uint32_t null_id = 0xffffffff;
+
+    struct node{
+        K key;
+        M meta;             //caller data kept along with the value
+        uint32_t len;
+        uint32_t prev , next;
+        uint32_t chunks[max_chunk];
+    };
+
+public:
+    explicit lru_cache(std::size_t n_chunk)
+    :n_chunk(std::max<std::size_t>(n_chunk , max_chunk)) , n_node(this->n_chunk) ,
+        mask(table_size(n_node) - 1) ,
+        table(new uint32_t[mask + 1]) , nodes(new node[n_node]) , arena(new char[this->n_chunk * chunk_size]){
+        std::fill(table.get() , table.get() + mask + 1 , null_id);
+
+        //every node and chunk starts on its free list
+        for(uint32_t i = 0 ; i < n_node ; ++i)
+            nodes[i].next = i + 1 == n_node ? null_id : i + 1;
+        for(uint32_t i = 0 ; i < this->n_chunk ; ++i)
+            next_chunk(i) = i + 1 == this->n_chunk ? null_id : i + 1;
+        free_node = 0;
+        free_chunk = 0;
+        free_chunk_cnt = this->n_chunk;
+    }
+
+    //false if the value can never fit
+    bool put(const K & key , const M & meta , const char * value , uint32_t len){
+        const uint32_t need = (len + chunk_size - 1) / chunk_size;
+        if(need > max_chunk) return false;
+
+        uint32_t id = find(key);
+        if(id != null_id) erase(id);
+
+        while(free_node == null_id || free_chunk_cnt < need)
+            erase(tail);
+
+        id = free_node;
+        auto & n = nodes[id];
+        free_node = n.next;
+
+        n.key = key;
+        n.meta = meta;
+        n.len = len;
+        for(uint32_t i = 0 ; i < need ; ++i , value += chunk_size){
+            n.chunks[i] = free_chunk;
+            free_chunk = next_chunk(free_chunk);
+            memcpy(chunk(n.chunks[i]) , value , std::min(chunk_size , len - i * chunk_size));
         }
-        else{
-            if(free_entries_.empty()){
-                node = tail_.prev;
-                detach(node);
-                hashmap_.erase(node->key);
-            }
-            else{
-                node = free_entries_.back();
-                free_entries_.pop_back();
-            }
-            node->key = key;
-            node->data = std::move(data);
-            hashmap_[key] = node;
-            attach(node);
+        free_chunk_cnt -= need;
+
+        table[probe_free(key)] = id;
+        attach(id);
+        return true;
+    }
+
+    //moved to the front on a hit
+    const node * get(const K & key){
+        uint32_t id = find(key);
+        if(id == null_id) return nullptr;
+        if(id != head){
+            detach(id);
+            attach(id);
         }
+        return &nodes[id];
     }
 
-    T * get(K key){
-        auto *node = hashmap_[key];
-        if(node){
-            detach(node);
-            attach(node);
-            return &node->data;
+    //whether a value of len fits without evicting anything
+    bool has_room(uint32_t len) const{
+        return free_node != null_id && free_chunk_cnt >= (len + chunk_size - 1) / chunk_size;
+    }
+
+    //next node to be evicted , nullptr if empty
+    const node * last() const{
+        return tail == null_id ? nullptr : &nodes[tail];
+    }
+
+    void copy(const node * n , char * buf) const{
+        for(uint32_t i = 0 , off = 0 ; off < n->len ; ++i , off += chunk_size)
+            memcpy(buf + off , chunk(n->chunks[i]) , std::min(chunk_size , n->len - off));
+    }
+
+    std::size_t free_space() const{
+        return std::size_t(free_chunk_cnt) * chunk_size;
+    }
+
+    //chunks a cache of budget bytes can hold , metadata included
+    static std::size_t chunks_for(std::size_t budget){
+        //a node per chunk and at most 4 table slots per node
+        return budget / (chunk_size + sizeof(node) + 4 * sizeof(uint32_t));
+    }
+
+    //bytes allocated
+    std::size_t memory_size() const{
+        return (mask + 1) * sizeof(uint32_t) + std::size_t(n_node) * sizeof(node) + std::size_t(n_chunk) * chunk_size;
+    }
+
+    //bytes in use : metadata plus the chunks holding values
+    std::size_t footprint() const{
+        return memory_size() - free_space();
+    }
+
+private:
+
+    static std::size_t table_size(std::size_t n){
+        std::size_t sz = 16;
+        while(sz < n * 2) sz <<= 1;
+        return sz;
+    }
+
+    std::size_t home(const K & key) const{
+        return (uint64_t(std::hash<K>{}(key)) * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+    }
+
+    uint32_t find(const K & key) const{
+        for(std::size_t i = home(key) ; table[i] != null_id ; i = (i + 1) & mask){
+            if(nodes[table[i]].key == key) return table[i];
         }
-        else{
-            return nullptr;
+        return null_id;
+    }
+
+    std::size_t probe_free(const K & key) const{
+        std::size_t i = home(key);
+        while(table[i] != null_id) i = (i + 1) & mask;
+        return i;
+    }
+
+    //backward shift , the table never holds tombstones
+    void erase(uint32_t id){
+        auto & n = nodes[id];
+        std::size_t i = home(n.key);
+        while(table[i] != id) i = (i + 1) & mask;
+        for(std::size_t j = (i + 1) & mask ; table[j] != null_id ; j = (j + 1) & mask){
+            const std::size_t h = home(nodes[table[j]].key);
+            //entry at j may move to i if its home is not in (i , j]
+            if(((j - h) & mask) >= ((j - i) & mask)){
+                table[i] = table[j];
+                i = j;
+            }
         }
+        table[i] = null_id;
+
+        const uint32_t cnt = (n.len + chunk_size - 1) / chunk_size;
+        for(uint32_t k = 0 ; k < cnt ; ++k){
+            next_chunk(n.chunks[k]) = free_chunk;
+            free_chunk = n.chunks[k];
+        }
+        free_chunk_cnt += cnt;
+
+        detach(id);
+        n.next = free_node;
+        free_node = id;
     }
 
-    std::size_t free_space(){
-        return free_entries_.size();
+    void detach(uint32_t id){
+        auto & n = nodes[id];
+        (n.prev == null_id ? head : nodes[n.prev].next) = n.next;
+        (n.next == null_id ? tail : nodes[n.next].prev) = n.prev;
     }
-private:
-    void detach(Node<K,T>* node){
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
+
+    void attach(uint32_t id){
+        auto & n = nodes[id];
+        n.prev = null_id;
+        n.next = head;
+        (head == null_id ? tail : nodes[head].prev) = id;
+        head = id;
+    }
+
+    char * chunk(uint32_t i) const{
+        return arena.get() + std::size_t(i) * chunk_size;
     }
-    void attach(Node<K,T>* node){
-        node->prev = &head_;
-        node->next = head_.next;
-        head_.next = node;
-        node->next->prev = node;
+
+    uint32_t & next_chunk(uint32_t i){
+        return *reinterpret_cast<uint32_t *>(chunk(i));
     }
+
 private:
-    std::unordered_map<K, Node<K,T>* > hashmap_;
-    std::vector<Node<K,T>* > free_entries_; 
-    Node<K,T> head_, tail_;
-    std::unique_ptr<Node<K,T>[]> entries_; 
+    const uint32_t n_chunk;
+    const uint32_t n_node;
+    const std::size_t mask;
+    std::unique_ptr<uint32_t[]> table;
+    std::unique_ptr<node[]> nodes;
+    std::unique_ptr<char[]> arena;
+    uint32_t free_node , free_chunk , free_chunk_cnt;
+    uint32_t head{null_id} , tail{null_id};
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,155 @@
+#ifndef LZ_CODEC_INCLUDE_H
+#define LZ_CODEC_INCLUDE_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+//LZ4 block format , tuned for values of a few KB :
+//  token [extra literal len] literals offset(2B LE) [extra match len]
+//a single pass with a 4K entry table , no backward extension of matches.
+//the last 5 bytes are always literals and no match starts in the last 12 ,
+//so the output is readable by any LZ4 block decoder too.
+class lz_codec{
+public:
+    static constexpr uint32_t hash_log = 12;
+    static constexpr uint32_t min_match = 4;
+    static constexpr uint32_t last_literals = 5;
+    static constexpr uint32_t match_limit = 12;
+    static constexpr uint32_t max_input = 1 << 16;     //positions are kept in 16 bit
+
+public:
+
+    //bytes written to dst , 0 if the result would not fit in cap
+    static uint32_t compress(const char * src , uint32_t n , char * dst , uint32_t cap){
+        if(n >= max_input) return 0;
+
+        const uint8_t * const base = reinterpret_cast<const uint8_t *>(src);
+        const uint8_t * const end = base + n;
+        const uint8_t * anchor = base;
+        uint8_t * op = reinterpret_cast<uint8_t *>(dst);
+        uint8_t * const oend = op + cap;
+
+        auto put_len = [&op](uint32_t len){
+            for(; len >= 255 ; len -= 255)
+                *op++ = 255;
+            *op++ = uint8_t(len);
+        };
+
+        //literals since anchor , then a match of mlen bytes back by offset unless mlen is 0
+        auto emit = [&](const uint8_t * ip , uint32_t offset , uint32_t mlen) -> bool {
+            const uint32_t lit = ip - anchor;
+            if(op + 1 + lit + lit / 255 + 1 + (mlen ? 2 + mlen / 255 + 1 : 0) > oend)
+                return false;
+            uint8_t * token = op++;
+            *token = uint8_t(std::min<uint32_t>(lit , 15) << 4);
+            if(lit >= 15) put_len(lit - 15);
+            memcpy(op , anchor , lit);
+            op += lit;
+            if(!mlen) return true;
+
+            *op++ = uint8_t(offset);
+            *op++ = uint8_t(offset >> 8);
+            const uint32_t m = mlen - min_match;
+            *token |= uint8_t(std::min<uint32_t>(m , 15));
+            if(m >= 15) put_len(m - 15);
+            return true;
+        };
+
+        if(n > match_limit){
+            uint16_t table[1 << hash_log];
+            memset(table , 0 , sizeof(table));
+            const uint8_t * const limit = end - match_limit;
+            const uint8_t * const match_end = end - last_literals;
+
+            const uint8_t * ip = base + 1;
+            while(ip < limit){
+                const uint32_t seq = read32(ip);
+                const uint32_t h = hash4(seq);
+                const uint8_t * ref = base + table[h];
+                table[h] = uint16_t(ip - base);
+                if(ref >= ip || read32(ref) != seq){
+                    ++ip;
+                    continue;
+                }
+
+                const uint8_t * m = ip + min_match , * r = ref + min_match;
+                while(m < match_end && *m == *r)
+                    ++m , ++r;
+                if(!emit(ip , ip - ref , m - ip))
+                    return 0;
+                ip = anchor = m;
+            }
+        }
+
+        if(!emit(end , 0 , 0))
+            return 0;
+        return op - reinterpret_cast<uint8_t *>(dst);
+    }
+
+    //false unless src decodes to exactly n bytes
+    static bool decompress(const char * src , uint32_t n_src , char * dst , uint32_t n){
+        const uint8_t * ip = reinterpret_cast<const uint8_t *>(src);
+        const uint8_t * const iend = ip + n_src;
+        uint8_t * op = reinterpret_cast<uint8_t *>(dst);
+        uint8_t * const oend = op + n;
+
+        auto get_len = [&ip , iend](uint32_t & len) -> bool {
+            uint8_t b;
+            do{
+                if(ip == iend) return false;
+                b = *ip++;
+                len += b;
+            }while(b == 255);
+            return true;
+        };
+
+        while(ip < iend){
+            const uint8_t token = *ip++;
+            uint32_t lit = token >> 4;
+            if(lit == 15 && !get_len(lit))
+                return false;
+            if(lit > uint32_t(iend - ip) || lit > uint32_t(oend - op))
+                return false;
+            memcpy(op , ip , lit);
+            op += lit , ip += lit;
+            if(ip == iend)
+                break;
+
+            if(iend - ip < 2)
+                return false;
+            const uint32_t offset = ip[0] | uint32_t(ip[1]) << 8;
+            ip += 2;
+            uint32_t mlen = token & 15;
+            if(mlen == 15 && !get_len(mlen))
+                return false;
+            mlen += min_match;
+            if(offset == 0 || offset > uint32_t(op - reinterpret_cast<uint8_t *>(dst)) || mlen > uint32_t(oend - op))
+                return false;
+
+            //an overlapping match repeats its last offset bytes
+            const uint8_t * ref = op - offset;
+            if(offset >= mlen)
+                memcpy(op , ref , mlen);
+            else
+                for(uint32_t k = 0 ; k < mlen ; ++k)
+                    op[k] = ref[k];
+            op += mlen;
+        }
+        return op == oend;
+    }
+
+private:
+
+    static uint32_t read32(const uint8_t * p){
+        uint32_t v;
+        memcpy(&v , p , sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash4(uint32_t v){
+        return (v * 2654435761u) >> (32 - hash_log);
+    }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef NUMA_TOPOLOGY_INCLUDE_H
+#define NUMA_TOPOLOGY_INCLUDE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cctype>
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "utils.hpp"
+
+//NUMA nodes as sysfs lists them , and page placement through the raw
+//syscalls , so libnuma is not needed. a host without node entries in
+//sysfs , or with a single node , is one node and placement is a no-op.
+//fake-NUMA kernels (numa=fake=N) show up in sysfs like real nodes.
+class numa_topology{
+public:
+    static constexpr uint32_t max_nodes = 64;     //one word of node mask
+
+public:
+    numa_topology() = default;
+
+    static numa_topology detect(const std::string & root = "/sys/devices/system/node"){
+        numa_topology topo{};
+        std::vector<uint32_t> ids{};
+        if(!parse_list(read_line(root + "/online") , ids) || ids.empty())
+            return topo;
+
+        for(auto id : ids){
+            std::vector<uint32_t> cpus{};
+            if(id >= max_nodes || !parse_list(read_line(root + "/node" + std::to_string(id) + "/cpulist") , cpus))
+                return numa_topology{};
+            for(auto cpu : cpus){
+                if(cpu >= topo.cpu_node.size())
+                    topo.cpu_node.resize(cpu + 1 , 0);
+                topo.cpu_node[cpu] = topo.node_ids.size();
+            }
+            topo.node_ids.push_back(id);
+        }
+        return topo;
+    }
+
+    uint32_t n_node() const{
+        return std::max<std::size_t>(node_ids.size() , 1);
+    }
+
+    //position of the node among n_node() , 0 if unknown
+    uint32_t node_of_cpu(uint32_t cpu) const{
+        return cpu < cpu_node.size() ? cpu_node[cpu] : 0;
+    }
+
+    uint32_t current_node() const{
+        const int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : node_of_cpu(cpu);
+    }
+
+    //n items in contiguous ranges , node i owns [first(i) , first(i + 1))
+    uint32_t first(uint32_t node , uint32_t n) const{
+        return uint64_t(n) * node / n_node();
+    }
+
+    //pages this thread touches from now on go round robin over the nodes
+    bool interleave() const{
+        if(n_node() < 2) return false;
+        unsigned long mask = 0;
+        for(auto id : node_ids)
+            mask |= 1ul << id;
+        return syscall(SYS_set_mempolicy , mpol_interleave , &mask , max_nodes + 1) == 0;
+    }
+
+    //back to first touch
+    static void local_policy(){
+        syscall(SYS_set_mempolicy , mpol_default , nullptr , 0);
+    }
+
+private:
+    static constexpr int mpol_default = 0;
+    static constexpr int mpol_interleave = 3;
+
+    static std::string read_line(const std::string & path){
+        std::ifstream in(path);
+        std::string line{};
+        std::getline(in , line);
+        return line;
+    }
+
+    //"0-3,8,10-11"
+    static bool parse_list(const std::string & s , std::vector<uint32_t> & out){
+        std::size_t i = 0;
+        auto number = [&s , &i](uint32_t & v){
+            if(i == s.size() || !isdigit(s[i])) return false;
+            for(v = 0 ; i < s.size() && isdigit(s[i]) && v < (1u << 20) ; ++i)
+                v = v * 10 + (s[i] - '0');
+            return true;
+        };
+        while(i < s.size()){
+            uint32_t lo , hi;
+            if(!number(lo)) return false;
+            hi = lo;
+            if(i < s.size() && s[i] == '-'){
+                ++i;
+                if(!number(hi) || hi < lo) return false;
+            }
+            for(uint32_t v = lo ; v <= hi ; ++v)
+                out.push_back(v);
+            if(i < s.size() && s[i++] != ',')
+                return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> node_ids{};       //sysfs ids
+    std::vector<uint32_t> cpu_node{};       //cpu => position in node_ids
+};
+
+#endif
@@ -5,22 +5,26 @@
 #include <atomic>
 #include <numeric>
 
-template<uint32_t N>
+#include "utils.hpp"
+
 class open_address_hash{
 public:
-    static constexpr uint32_t n_bucket = N;
     static constexpr uint32_t null_id = 0xffffffff;
+    static constexpr uint32_t kind = 1;     //checkpoint format
 
 private:
 
     using bucket_type = uint64_t;
     static constexpr uint64_t null_bucket = std::numeric_limits<uint64_t>::max();
+    //erased slot , keeps the probe chain going and can be reused by insert
+    static constexpr uint64_t deleted_bucket = null_bucket - (1ull << 32);
 
 public:
 
-    explicit open_address_hash() noexcept{
-        auto p = new bucket_type[N];
-        memset(p , 0xff , sizeof(bucket_type) * N );
+    explicit open_address_hash(uint32_t n) noexcept
+    :n_bucket(n){
+        auto p = new bucket_type[n];
+        memset(p , 0xff , sizeof(bucket_type) * n );
 
         bucket.reset(reinterpret_cast<std::atomic<bucket_type>*>(p));
     }
@@ -34,10 +38,10 @@ public:
 
         info = {prefix , key_index};
 
-        for (uint32_t i = hash % N ,cnt = 0 ; cnt < N ; ++cnt ,++i , i %= N){
-            if(bucket[i] != null_bucket) continue;
+        for (uint32_t i = home(hash) ,cnt = 0 ; cnt < n_bucket ; ++cnt , i = next(i)){
+            uint64_t empty_val = bucket[i];
+            if(empty_val != null_bucket && empty_val != deleted_bucket) continue;
 
-            uint64_t empty_val {null_bucket};
             if(bucket[i].compare_exchange_weak(
                 empty_val, n,
                 std::memory_order_release ,
@@ -54,16 +58,87 @@ public:
             uint64_t n ;
         };
 
-        for(uint32_t i = hash % N , cnt = 0 ; cnt < N ; ++ cnt , ++i , i %= N ){
-            if(bucket[i] == null_bucket) break;
+        for(uint32_t i = home(hash) , cnt = 0 ; cnt < n_bucket ; ++ cnt , i = next(i) ){
             n = bucket[i];
-            if(info.first != prefix) continue;
+            if(n == null_bucket) break;
+            if(info.first != prefix || n == deleted_bucket) continue;
             if(key_cmp_eq(info.second)) return info.second;
         }
         return null_id;
     }
 
+    //returns the erased key_index
+    template<class F>
+    uint32_t erase(uint64_t hash , uint32_t prefix , F && key_cmp_eq){
+        union {
+            std::pair<uint32_t , uint32_t > info{} ;
+            uint64_t n ;
+        };
+
+        for(uint32_t i = home(hash) , cnt = 0 ; cnt < n_bucket ; ++ cnt , i = next(i) ){
+            n = bucket[i];
+            if(n == null_bucket) break;
+            if(info.first != prefix || n == deleted_bucket) continue;
+            if(key_cmp_eq(info.second)){
+                uint64_t val = n;
+                if(bucket[i].compare_exchange_strong(
+                    val , deleted_bucket ,
+                    std::memory_order_release ,
+                    std::memory_order_relaxed))
+                    return info.second;
+            }
+        }
+        return null_id;
+    }
+
+    void prefetch(uint64_t hash) const{
+        prefetch_t0(&bucket[home(hash)]);
+    }
+
+    //first key_index in the probe chain whose prefix matches , without comparing keys
+    uint32_t peek(uint64_t hash , uint32_t prefix) const{
+        union {
+            std::pair<uint32_t , uint32_t > info{} ;
+            uint64_t n ;
+        };
+
+        for(uint32_t i = home(hash) , cnt = 0 ; cnt < n_bucket ; ++ cnt , i = next(i) ){
+            n = bucket[i].load(std::memory_order_relaxed);
+            if(n == null_bucket) break;
+            if(info.first == prefix && n != deleted_bucket) return info.second;
+        }
+        return null_id;
+    }
+
+    bool dump(FILE * f) const{
+        return dump_pod(f , reinterpret_cast<const bucket_type *>(bucket.get()) , n_bucket);
+    }
+
+    bool load(FILE * f){
+        return load_pod(f , reinterpret_cast<bucket_type *>(bucket.get()) , n_bucket);
+    }
+
+    //not thread safe
+    void clear(){
+        memset(reinterpret_cast<bucket_type *>(bucket.get()) , 0xff , sizeof(bucket_type) * n_bucket);
+    }
+
+    uint32_t size() const{
+        return n_bucket;
+    }
+
+private:
+
+    uint32_t home(uint64_t hash) const{
+        return fast_range(hash , n_bucket);
+    }
+
+    uint32_t next(uint32_t i) const{
+        return ++i == n_bucket ? 0 : i;
+    }
+
 private:
+    const uint32_t n_bucket;
     std::unique_ptr<std::atomic<bucket_type>[]> bucket{};
 };
 
@@ -0,0 +1,107 @@
+#ifndef RCU_PTR_INCLUDE_H
+#define RCU_PTR_INCLUDE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "utils.hpp"
+
+//readers count themselves in a stripe of the current phase around their
+//use of shared objects , synchronize() flips the phase and waits until the
+//old one has drained : what was unlinked before it is reached by no reader.
+//readers never wait , synchronize() must not be called by a reader.
+template<std::size_t n_stripe>
+class rcu_domain : disable_copy{
+    struct alignas(CACHELINE_SIZE) stripe_t{
+        std::atomic<uint32_t> readers[2];
+    };
+
+public:
+    //a reader for its lifetime
+    class reader : disable_copy{
+    public:
+        reader(rcu_domain & domain , uint32_t stripe)
+        :n(domain.enter(stripe)){
+        }
+
+        ~reader(){
+            n.fetch_sub(1 , std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint32_t> & n;
+    };
+
+    rcu_domain(){
+        for(auto & s : stripes)
+            s.readers[0].store(0 , std::memory_order_relaxed) , s.readers[1].store(0 , std::memory_order_relaxed);
+    }
+
+    void synchronize(){
+        std::lock_guard<std::mutex> guard(writer);
+        const uint32_t ph = phase.fetch_add(1 , std::memory_order_seq_cst) & 1;
+        for(auto & s : stripes)
+            while(s.readers[ph].load(std::memory_order_acquire))
+                std::this_thread::yield();
+    }
+
+    //for callers that keep no stripe of their own
+    static uint32_t thread_stripe(){
+        static std::atomic<uint32_t> seq{0};
+        static thread_local uint32_t stripe = seq.fetch_add(1 , std::memory_order_relaxed);
+        return stripe;
+    }
+
+private:
+    std::atomic<uint32_t> & enter(uint32_t stripe){
+        auto & s = stripes[stripe % n_stripe];
+        //a writer may flip the phase and drain its count before ours lands ,
+        //the count only holds if the phase is still the one it was taken in
+        for(;;){
+            const uint32_t seen = phase.load(std::memory_order_seq_cst);
+            auto & n = s.readers[seen & 1];
+            n.fetch_add(1 , std::memory_order_seq_cst);
+            if(likely(phase.load(std::memory_order_seq_cst) == seen))
+                return n;
+            n.fetch_sub(1 , std::memory_order_release);
+        }
+    }
+
+private:
+    std::atomic<uint32_t> phase{0};
+    std::mutex writer;
+    stripe_t stripes[n_stripe];
+};
+
+//an immutable object replaced as a whole : a writer swaps the pointer and
+//frees the old object once no reader can hold it any more
+template<class T , std::size_t n_stripe>
+class rcu_ptr : disable_copy{
+public:
+    rcu_ptr() = default;
+
+    ~rcu_ptr(){
+        delete cur.load(std::memory_order_relaxed);
+    }
+
+    //f(const T *) , the pointer is null before the first publish
+    template<class F>
+    auto read(uint32_t stripe , F && f) -> decltype(f(static_cast<const T *>(nullptr))){
+        typename rcu_domain<n_stripe>::reader guard(domain , stripe);
+        return f(cur.load(std::memory_order_seq_cst));
+    }
+
+    void publish(std::unique_ptr<T> next){
+        std::unique_ptr<T> old(cur.exchange(next.release() , std::memory_order_seq_cst));
+        //a reader of the old phase may still hold it , later ones see next
+        domain.synchronize();
+    }
+
+private:
+    std::atomic<T *> cur{nullptr};
+    rcu_domain<n_stripe> domain;
+};
+
+#endif
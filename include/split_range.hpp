@@ -0,0 +1,64 @@
+#ifndef SPLIT_RANGE_INCLUDE_H
+#define SPLIT_RANGE_INCLUDE_H
+
+#include <atomic>
+
+#include "utils.hpp"
+
+//a range of slots handed out from both ends without locks : its owner
+//takes them from the bottom , other partitions borrow whole chunks from
+//the top. both ends live in one word , so they never cross.
+class split_range : disable_copy{
+public:
+    static constexpr uint32_t null_off = 0xffffffff;
+
+public:
+    split_range() = default;
+
+    void init(uint32_t lo , uint32_t hi){
+        span.store(pack(lo , hi) , std::memory_order_relaxed);
+    }
+
+    uint32_t low() const{
+        return uint32_t(span.load(std::memory_order_relaxed));
+    }
+
+    uint32_t high() const{
+        return uint32_t(span.load(std::memory_order_relaxed) >> 32);
+    }
+
+    //n slots from the bottom , by the owner
+    uint32_t take(uint32_t n){
+        uint64_t cur = span.load(std::memory_order_relaxed);
+        do{
+            if(uint32_t(cur) + n > uint32_t(cur >> 32)) return null_off;
+        }while(!span.compare_exchange_weak(cur , cur + n , std::memory_order_relaxed));
+        return uint32_t(cur);
+    }
+
+    //n slots from the top , by anyone
+    uint32_t take_top(uint32_t n){
+        uint64_t cur = span.load(std::memory_order_relaxed);
+        do{
+            if(uint32_t(cur) + n > uint32_t(cur >> 32)) return null_off;
+        }while(!span.compare_exchange_weak(cur , cur - (uint64_t(n) << 32) , std::memory_order_relaxed));
+        return uint32_t(cur >> 32) - n;
+    }
+
+    //moves the bottom back , by the owner
+    void set_low(uint32_t lo){
+        uint64_t cur = span.load(std::memory_order_relaxed);
+        while(!span.compare_exchange_weak(cur , pack(lo , uint32_t(cur >> 32)) , std::memory_order_relaxed));
+    }
+
+private:
+
+    static uint64_t pack(uint32_t lo , uint32_t hi){
+        return uint64_t(hi) << 32 | lo;
+    }
+
+private:
+    std::atomic<uint64_t> span{0};
+};
+
+#endif
@@ -2,10 +2,16 @@
 #ifndef UTILS_INCLUDE_H
 #define UTILS_INCLUDE_H
 
+#include <atomic>
 #include <chrono>
 #include <type_traits>
+#include <vector>
+#include <cstdio>
+#include <cstring>
 #include <immintrin.h>
 
+#include "cpu_kernels.hpp"
+
 #define CACHELINE_SIZE 64
 
 #define UNUSED(x) (void)x
@@ -28,6 +34,22 @@ struct alignas(64) atomic_uint_align64_t : std::atomic<uint32_t>{
 	}
 };
 
+//for short sections that are almost never contended
+struct spin_lock : disable_copy{
+	std::atomic<bool> flag{false};
+
+	void lock(){
+		while(flag.exchange(true , std::memory_order_acquire)){
+			while(flag.load(std::memory_order_relaxed))
+				_mm_pause();
+		}
+	}
+
+	void unlock(){
+		flag.store(false , std::memory_order_release);
+	}
+};
+
 template<class T , std::size_t N>
 struct alignas(N) align_intergral_t{
 	static_assert(std::is_integral<T>{} , "T must be trivial");
@@ -67,6 +89,16 @@ static inline constexpr size_t operator "" _KB (unsigned long long n){
 	return n * 1024;
 }
 
+static inline void prefetch_t0(const void * ptr){
+	_mm_prefetch(reinterpret_cast<const char *>(ptr) , _MM_HINT_T0);
+}
+
+//maps a hash onto [0 , n) with a multiply instead of a division
+static inline uint64_t fast_range(uint64_t hash , uint64_t n){
+	return static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * n) >> 64);
+}
+
+//keys are 16B : two scalar compares beat any vector width , same for hash_bytes_16
 static inline bool fast_key_cmp_eq(const char * lhs , const char * rhs){
     using pcu64_t = const uint64_t *;
     return *((pcu64_t)(lhs)) == *((pcu64_t)(rhs)) && *((pcu64_t)(lhs)+1) == *((pcu64_t)(rhs)+1) ;
@@ -82,16 +114,22 @@ static inline void memcpy_avx_16(void *dst, const void *src) {
 #endif
 }
 
+//fixed size copies stay on SSE2 : at 32-128B a wider register saves a
+//store or two , less than an indirect call through cpu_kernels costs
 static inline void memcpy_avx_32(void *dst, const void *src) {
-	__m256i m0 = _mm256_loadu_si256(((const __m256i*)src) + 0);
-	_mm256_storeu_si256(((__m256i*)dst) + 0, m0);
+	memcpy_avx_16(dst , src);
+	memcpy_avx_16((char*)dst + 16 , (const char*)src + 16);
 }
 
 static inline void memcpy_avx_64(void *dst, const void *src) {
-	__m256i m0 = _mm256_loadu_si256(((const __m256i*)src) + 0);
-	__m256i m1 = _mm256_loadu_si256(((const __m256i*)src) + 1);
-	_mm256_storeu_si256(((__m256i*)dst) + 0, m0);
-	_mm256_storeu_si256(((__m256i*)dst) + 1, m1);
+	__m128i m0 = _mm_loadu_si128(((const __m128i*)src) + 0);
+	__m128i m1 = _mm_loadu_si128(((const __m128i*)src) + 1);
+	__m128i m2 = _mm_loadu_si128(((const __m128i*)src) + 2);
+	__m128i m3 = _mm_loadu_si128(((const __m128i*)src) + 3);
+	_mm_storeu_si128(((__m128i*)dst) + 0, m0);
+	_mm_storeu_si128(((__m128i*)dst) + 1, m1);
+	_mm_storeu_si128(((__m128i*)dst) + 2, m2);
+	_mm_storeu_si128(((__m128i*)dst) + 3, m3);
 }
 
 static inline void memcpy_avx_80(void * dst , const void * src){
@@ -100,14 +138,33 @@ static inline void memcpy_avx_80(void * dst , const void * src){
 }
 
 static inline void memcpy_avx_128(void *dst, const void *src) {
-	__m256i m0 = _mm256_loadu_si256(((const __m256i*)src) + 0);
-	__m256i m1 = _mm256_loadu_si256(((const __m256i*)src) + 1);
-	__m256i m2 = _mm256_loadu_si256(((const __m256i*)src) + 2);
-	__m256i m3 = _mm256_loadu_si256(((const __m256i*)src) + 3);
-	_mm256_storeu_si256(((__m256i*)dst) + 0, m0);
-	_mm256_storeu_si256(((__m256i*)dst) + 1, m1);
-	_mm256_storeu_si256(((__m256i*)dst) + 2, m2);
-	_mm256_storeu_si256(((__m256i*)dst) + 3, m3);
+	memcpy_avx_64(dst , src);
+	memcpy_avx_64((char*)dst + 64 , (const char*)src + 64);
+}
+
+//raw dump / load of trivially copyable data , for checkpoints
+template<class T>
+static inline bool dump_pod(FILE * f , const T * p , size_t n = 1){
+	return fwrite(p , sizeof(T) , n , f) == n;
+}
+
+template<class T>
+static inline bool load_pod(FILE * f , T * p , size_t n = 1){
+	return fread(p , sizeof(T) , n , f) == n;
+}
+
+template<class T>
+static inline bool dump_vector(FILE * f , const std::vector<T> & v){
+	uint64_t n = v.size();
+	return dump_pod(f , &n) && dump_pod(f , v.data() , n);
+}
+
+template<class T>
+static inline bool load_vector(FILE * f , std::vector<T> & v){
+	uint64_t n{};
+	if(!load_pod(f , &n)) return false;
+	v.resize(n);
+	return load_pod(f , v.data() , n);
 }
 
 //https://gcc.gnu.org/bugzilla/show_bug.cgi?id=57350
@@ -121,31 +178,4 @@ inline void *align( std::size_t alignment, std::size_t size,
     return ptr = reinterpret_cast< void * >( aligned );
 }
 
-inline std::size_t
-shift_mix(std::size_t v)
-{ return v ^ (v >> 47);}
-
-static inline size_t hash_impl(uint64_t lo, uint64_t hi){
-    constexpr size_t mul = (((size_t) 0xc6a4a793UL) << 32UL) + (size_t) 0x5bd1e995UL;
-    constexpr size_t len = 16 , seed = 0xc70f6907UL , beg = seed ^ (len * mul);
-
-    size_t hash = beg;
- 
-	const size_t data1 = shift_mix(lo * mul) * mul ;
-    const size_t data2 = shift_mix(hi * mul) * mul;
-
-	hash ^= data1;
-	hash *= mul;
-	hash ^= data2;
-	hash *= mul;
-
-    hash = shift_mix(hash) * mul;
-    hash = shift_mix(hash);
-    return hash;
-}
-
-static inline size_t hash_bytes_16(const char * ptr){	
-	return hash_impl(*(uint64_t *)(ptr) , *(uint64_t *)(ptr + 8));
-}
-
 #endif
\ No newline at end of file
@@ -6,10 +6,14 @@
 #include <algorithm>
 #include <numeric>
 #include <future>
+#include <thread>
+#include <random>
 
 #include <libpmem.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <signal.h>
 
 #include <cassert>
@@ -20,283 +24,1248 @@ Status DB::CreateOrOpen(const std::string &name, DB **dbptr, FILE *log_file) {
     return NvmEngine::CreateOrOpen(name, dbptr);
 }
 
+Status DB::CreateOrOpen(const std::string &name, DB **dbptr, const Options &options, FILE *log_file) {
+    return NvmEngine::CreateOrOpen(name, dbptr, options);
+}
+
 DB::~DB() {}
 
-Status NvmEngine::CreateOrOpen(const std::string &name, DB **dbptr) {
-    *dbptr = new NvmEngine(name);
+std::atomic<uint64_t> NvmEngine::instance_seq{1};
+
+Status NvmEngine::CreateOrOpen(const std::string &name, DB **dbptr, const Options &options) {
+    layout_info layout{};
+    engine_meta m{};
+    const size_t size = read_file_meta(name , m);
+
+    bool ok{false};
+    if(size && m.magic == META_MAGIC)
+        ok = size == m.file_size && make_layout(m.file_size , m.key_area , m.n_bucket , m.head_size , options.cache_budget , layout);
+    else if(size)   //written before the shape was kept in meta
+        ok = make_layout(size , 0 , THREAD_CNT , 0 , options.cache_budget , layout);
+    else
+        ok = make_layout(options.file_size , options.key_area , options.partitions , options.head_size , options.cache_budget , layout);
+
+    if(!ok) return IOError;
+    layout.compact_interval_ms = options.compact_interval_ms;
+    layout.compress_threshold = options.compress_threshold;
+    layout.checksum_writes = options.checksum_writes;
+    layout.hot_keys = std::min<uint32_t>(options.hot_keys , MAX_HOT);
+    layout.numa_aware = options.numa_aware;
+
+    //index , filter , versions and caches are spread over the nodes as
+    //the constructor first touches them , threads started meanwhile inherit it
+    const bool spread = options.numa_aware && numa_topology::detect().interleave();
+    *dbptr = new NvmEngine(name , layout);
+    if(spread)
+        numa_topology::local_policy();
     return Ok;
 }
 
-NvmEngine::NvmEngine(const std::string &name) {
+size_t NvmEngine::read_file_meta(const std::string & name , engine_meta & m){
+    int fd = open(name.c_str() , O_RDONLY);
+    if(fd < 0) return 0;
+
+    struct stat st{};
+    size_t size{0};
+    if(fstat(fd , &st) == 0 && size_t(st.st_size) >= META_SIZE
+        && pread(fd , &m , sizeof(m) , st.st_size - META_SIZE) == ssize_t(sizeof(m)))
+        size = st.st_size;
+    close(fd);
+    return size;
+}
+
+bool NvmEngine::make_layout(size_t file_size , size_t key_area , size_t partitions , size_t head_size , size_t cache_budget , layout_info & layout){
+    if(!file_size) file_size = NVM_SIZE;
+    if(!key_area) key_area = file_size / 256 * (KEY_AREA / (NVM_SIZE / 256));
+    if(!partitions) partitions = PARTITION_CNT;
+    if(!head_size) head_size = sizeof(head_info);
+    if(partitions > MAX_BUCKET || key_area + META_SIZE > file_size) return false;
+    //slots never straddle a 256B line
+    if(head_size != 64 && head_size != 128 && head_size != 256) return false;
+
+    const size_t n_key = key_area / head_size / partitions * partitions;
+    const size_t value_beg = kv_file_info::value_offset(n_key , head_size);
+    if(value_beg + META_SIZE > file_size) return false;
+    const size_t n_value = (file_size - META_SIZE - value_beg) / sizeof(value_block);
+    //even , so that 256B blocks stay aligned in every partition
+    const size_t n_block_per_bk = n_value / partitions & ~size_t(1);
+
+    //ids are 32 bit , the index holds 2 slots per key
+    if(n_key == 0 || n_block_per_bk == 0 || n_key * 2 >= UINT32_MAX || n_value >= UINT32_MAX)
+        return false;
+
+    //about one byte per key by default
+    if(!cache_budget) cache_budget = n_key;
+
+    layout = layout_info{
+        file_size , key_area , uint32_t(partitions) , uint32_t(n_key) , uint32_t(n_value) , 
+        uint32_t(n_key / partitions) , uint32_t(n_block_per_bk) , uint32_t(head_size) , cache_budget
+    };
+    return true;
+}
+
+NvmEngine::NvmEngine(const std::string &name, const layout_info &layout) 
+: layout(layout) , ckpt_name(name + ".ckpt") , instance_id(instance_seq ++) , 
+    leases(std::make_shared<lease_table>(layout.n_bucket)) ,
+    numa(layout.numa_aware ? numa_topology::detect() : numa_topology{}) , index(layout.n_key * 2) , filter(size_t(layout.n_key) * 8) 
+    #ifndef THREAD_LOCAL_CACHE
+    , shared_cache(layout.cache_bytes)
+    #else
+    , local_cache_bytes(std::make_shared<std::atomic<int64_t>>(0))
+    #endif
+    , sketch(layout.cache_bytes / CACHE_VALUE_AVG) , counters(new cache_counter[COUNTER_STRIPE]) {
 
     bool is_exist = access(name.data() , 0) == 0;
-    auto p = pmem_map_file(name.c_str(),NVM_SIZE,PMEM_FILE_CREATE, 0666, nullptr,nullptr);
+    auto p = pmem_map_file(name.c_str(),layout.file_size,PMEM_FILE_CREATE, 0666, nullptr,nullptr);
     if(!p){
         perror("pmem map failed");
         exit(0);
     }
 
-    file = decltype(file){p , NVM_SIZE};
+    file = kv_file_info{p , layout.file_size , layout.n_key , layout.n_value , layout.head_size};
 
-    if(is_exist)
-        recovery();
-    else
+    //files written before the shape was kept in meta get one here
+    const bool has_meta = meta()->magic == META_MAGIC;
+    if(!has_meta)
+        init_meta();
+
+    if(!is_exist)
         first_init();
+    else if(!has_meta || !meta()->ckpt_clean || !load_checkpoint())
+        recovery();
 
-    auto arr = new uint32_t[N_KEY];
-    memset(arr , 0 , sizeof(uint32_t) * N_KEY);
+    //a checkpoint is stale once anything is written
+    set_clean(false);
+
+    auto arr = new uint32_t[layout.n_key];
+    memset(arr , 0 , sizeof(uint32_t) * layout.n_key);
     ver_seq.reset(reinterpret_cast<std::atomic<uint32_t> *>(arr));
+
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i)
+        bucket_infos[i].allocator.attach(&retiring);
+
+    //tracks more keys than the table holds , so the top ones are counted well
+    if(layout.hot_keys){
+        hot_top.reset(new space_saving(layout.hot_keys * 4));
+        samples.reset(new sample_ring[COUNTER_STRIPE]);
+    }
+
+    if(layout.compact_interval_ms || layout.hot_keys){
+        background = std::thread([this](){
+            using clock = std::chrono::steady_clock;
+            if(this->layout.numa_aware)
+                numa_topology::local_policy();
+            const auto compact_every = std::chrono::milliseconds(this->layout.compact_interval_ms);
+            auto tick = std::chrono::milliseconds(this->layout.hot_keys ? HOT_INTERVAL_MS : this->layout.compact_interval_ms);
+            if(this->layout.compact_interval_ms)
+                tick = std::min(tick , compact_every);
+            auto next_compact = clock::now() + compact_every;
+
+            std::unique_lock<std::mutex> guard(stop_mutex);
+            while(!stop_cv.wait_for(guard , tick , [this]{ return background_stop; })){
+                guard.unlock();
+                if(this->layout.hot_keys)
+                    refresh_hot();
+                if(this->layout.compact_interval_ms && clock::now() >= next_compact){
+                    compact();
+                    next_compact = clock::now() + compact_every;
+                }
+                guard.lock();
+            }
+        });
+    }
 }
 
 Status NvmEngine::Get(const Slice &key, std::string *value) {
-    static thread_local lru_cache_t cache;
+    auto hash = hash_bytes_16(key.data());
+    return get_value(key , hash , *value , value_cache());
+}
 
+Status NvmEngine::Get(const Slice &key, char *buf, size_t cap, size_t *len) {
+    auto & cache = value_cache();
     auto hash = hash_bytes_16(key.data());
-    // auto head = search(key , hash);
-    uint32_t key_index = search_get(key , hash ,cache);
+    if(layout.hot_keys && hot_get(key.data() , hash , [buf , cap , len](const char * , uint32_t n){
+        *len = n;
+        return n <= cap ? buf : nullptr;
+    }))
+        return *len > cap ? OutOfMemory : Ok;
+
+    for(;;){
+        uint32_t key_index = search_get(key , hash , cache);
+        if(unlikely(key_index == index.null_id))
+            return NotFound;
+        if(layout.hot_keys)
+            sample_read(key_index);
+
+        //an entry of this ver may belong to the key the head was reused for
+        uint32_t ver = stable_ver(key_index);
+        bool same{true};
+        if(likely(cache_get(cache , key_index , ver , [buf , cap , len , &key , &same](const char * k , uint32_t n) -> char * {
+            if(!(same = fast_key_cmp_eq(k , key.data())))
+                return nullptr;
+            *len = n;
+            return n <= cap ? buf : nullptr;
+        }))){
+            if(likely(same))
+                return *len > cap ? OutOfMemory : Ok;
+            continue;
+        }
 
-    if(likely(key_index != index.null_id)){
-        read_value(key , *value , key_index , cache);
+        //deleted or reused since the lookup , look again
+        head_info head;
+        if(unlikely(!read_head(key_index , key.data() , head , ver)))
+            continue;
+        *len = head.value_len;
+        if(unlikely(*len > cap))
+            return OutOfMemory;
+        const bool intact = copy_blocks(head , buf);
+        if(unlikely(!unchanged(key_index , ver)))
+            continue;
+        if(unlikely(!intact))
+            return IOError;
+
+        cache_put(cache , key_index , ver , key.data() , buf , *len);
         return Ok;
-    }else
-        return NotFound;
+    }
+}
+
+Status NvmEngine::GetPinned(const Slice &key, PinnedValue *pinned) {
+    auto hash = hash_bytes_16(key.data());
+    //pinned at an even ver only , one a writer still holds would pass
+    //IsPinnedValid once it is done
+    head_info head;
+    uint32_t key_index , ver;
+    do{
+        key_index = search_get(key , hash , value_cache());
+        if(unlikely(key_index == index.null_id))
+            return NotFound;
+    }while(unlikely(!read_head(key_index , key.data() , head , ver)));
+
+    pinned->id = key_index;
+    pinned->version = ver;
+    if(unlikely(is_packed(head.index[head.index_flag])))
+        return IOError;
+    pinned->size = head.value_len;
+    pinned->count = value_pieces(head , pinned->pieces);
+    return Ok;
+}
+
+bool NvmEngine::IsPinnedValid(const PinnedValue &pinned) {
+    //old blocks are only reused after the writer bumps ver_seq
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return ver_seq[pinned.id].load(std::memory_order_relaxed) == pinned.version;
+}
+
+Status NvmEngine::MultiGet(const Slice *keys, size_t n, std::string *values, Status *out) {
+    auto & cache = value_cache();
+    Status sta{Ok};
+    std::array<uint64_t , MULTIGET_GROUP> hashes;
+    std::array<const char * , MULTIGET_GROUP> ptrs;
+
+    for(size_t beg = 0 ; beg < n ; beg += MULTIGET_GROUP){
+        const size_t cnt = std::min(n - beg , MULTIGET_GROUP);
+        const Slice * ks = keys + beg;
+
+        //stage 1 : hash all keys side by side and touch their home slots
+        for(size_t i = 0 ; i < cnt ; ++i)
+            ptrs[i] = ks[i].data();
+        hash_bytes_16_n(ptrs.data() , cnt , hashes.data());
+        for(size_t i = 0 ; i < cnt ; ++i){
+            filter.prefetch(hashes[i]);
+            index.prefetch(hashes[i]);
+        }
+
+        //stage 2 : slots are in flight , touch the candidate heads
+        for(size_t i = 0 ; i < cnt ; ++i){
+            if(!filter.may_contain(hashes[i]))
+                continue;
+            auto key_id = index.peek(hashes[i] , key_prefix(ks[i].data()));
+            if(key_id != index.null_id)
+                prefetch_t0(&file.key_head(key_id));
+        }
+
+        //stage 3 : compare and copy
+        for(size_t i = 0 ; i < cnt ; ++i){
+            out[beg + i] = get_value(ks[i] , hashes[i] , values[beg + i] , cache);
+            if(out[beg + i] != Ok) sta = out[beg + i];
+        }
+    }
+    return sta;
+}
+
+Status NvmEngine::get_value(const Slice & key , uint64_t hash , std::string & value , value_cache_t & cache){
+    if(layout.hot_keys && hot_get(key.data() , hash , [&value](const char * , uint32_t n){
+        value.resize(n);
+        return &value[0];
+    }))
+        return Ok;
+
+    for(;;){
+        uint32_t key_index = search_get(key , hash ,cache);
+        if(unlikely(key_index == index.null_id))
+            return NotFound;
+        if(layout.hot_keys)
+            sample_read(key_index);
+        auto sta = read_value(key , value , key_index , cache);
+        if(likely(sta != NotFound))
+            return sta;
+    }
 }
 
 constexpr uint64_t _Milli = 1000000;
 
 Status NvmEngine::Set(const Slice &key, const Slice &value) {
 
-    static thread_local uint32_t bucket_id = get_bucket_id() ;
+    auto lease = lease_bucket();
 
     auto hash = hash_bytes_16(key.data());
     uint32_t key_index {index.null_id};
-    if(bitset.test(hash % bitset.max_index))
+    if(filter.may_contain(hash))
         key_index = search(key , hash);
 
+    static thread_local std::string packed{};
+    const Slice stored = pack_value(value , packed);
+    if(unlikely(stored.size() > MAX_STORED))
+        return IOError;
+
     Status sta{Ok};
-    if(key_index != index.null_id){
-        sta = update(value , hash , key_index , bucket_id);
+    //an exhausted partition is traded for a free one
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ){
+        if(key_index != index.null_id){
+            sta = update(key , value , stored , hash , key_index , lease.bucket_id);
+        }
+        else {
+            sta = append(key,value , stored , hash , lease.bucket_id);
+        }
+        //the head was deleted or reused before it was locked , look again
+        if(unlikely(sta == NotFound)){
+            key_index = filter.may_contain(hash) ? search(key , hash) : index.null_id;
+            continue;
+        }
+        if(likely(sta != OutOfMemory) || !switch_bucket(lease))
+            break;
+        ++i;
     }
-    else {
-        sta = append(key,value , hash , bucket_id);
+
+    return sta;
+}
+
+Status NvmEngine::Delete(const Slice &key) {
+
+    auto lease = lease_bucket();
+    const uint32_t bucket_id = lease.bucket_id;
+
+    auto hash = hash_bytes_16(key.data());
+    if(!filter.may_contain(hash))
+        return NotFound;
+
+    uint32_t key_index = index.erase(hash , key_prefix(key.data()) , [this , &key](uint32_t key_id){
+        return fast_key_cmp_eq(file.key_head(key_id).key , key.data());
+    });
+    if(key_index == index.null_id)
+        return NotFound;
+
+    lock_key(key_index);
+    auto & head = file.key_head(key_index);
+    auto block = head.index[head.index_flag];
+    auto len = head.value_len;
+    persist_tombstone(head);
+
+    recollect_value_blocks(bucket_id , block , len);
+    bucket_infos[bucket_id].free_keys.push_back(key_index);
+    unlock_key(key_index);
+    return Ok;
+}
+
+Status NvmEngine::Write(const WriteBatch &batch) {
+
+    auto & entries = batch.Entries();
+
+    //last put of a key wins
+    std::vector<uint32_t> order(entries.size());
+    std::iota(order.begin() , order.end() , 0);
+    std::stable_sort(order.begin() , order.end() , [&entries](uint32_t l , uint32_t r){
+        return memcmp(entries[l].first.data() , entries[r].first.data() , KEY_SIZE) < 0;
+    });
+
+    std::vector<const char *> ptrs(entries.size());
+    std::vector<uint64_t> hashes(entries.size());
+    for(uint32_t i = 0 ; i < order.size() ; ++i)
+        ptrs[i] = entries[order[i]].first.data();
+    hash_bytes_16_n(ptrs.data() , ptrs.size() , hashes.data());
+
+    std::vector<batch_op> ops{};
+    ops.reserve(entries.size());
+    for(uint32_t i = 0 ; i < order.size() ; ++i){
+        if(i + 1 < order.size() && entries[order[i]].first == entries[order[i + 1]].first)
+            continue;
+        auto & kv = entries[order[i]];
+        ops.push_back(batch_op{&kv.first , &kv.second , hashes[i] , index.null_id , false , {} , {} , {}});
+        auto & op = ops.back();
+        op.stored = pack_value(Slice{const_cast<char *>(kv.second.data()) , kv.second.size()} , op.packed);
+        //one value too long refuses the whole batch , before anything is written
+        if(unlikely(op.stored.size() > MAX_STORED))
+            return IOError;
     }
 
+    auto lease = lease_bucket();
+    Status sta{Ok};
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ){
+        sta = write_batch(ops , lease.bucket_id);
+        //looked up again on the next try
+        if(unlikely(sta == NotFound))
+            continue;
+        if(likely(sta != OutOfMemory) || !switch_bucket(lease))
+            break;
+        ++i;
+    }
     return sta;
 }
 
+//NotFound if a head found by its key changed hands before it was locked
+Status NvmEngine::write_batch(std::vector<batch_op> & ops , uint32_t bucket_id){
+
+    auto & bucket = bucket_infos[bucket_id];
+
+    //allocate everything first , so that running out of space leaves no trace
+    const uint32_t key_seq = bucket.keys.low();
+    uint32_t n_key{0};
+    for(auto & op : ops){
+        op.key_index = index.null_id;
+        op.is_new = false;
+        if(filter.may_contain(op.hash))
+            op.key_index = search(Slice{const_cast<char *>(op.key->data()) , KEY_SIZE} , op.hash);
+        if(op.key_index == index.null_id){
+            op.is_new = true;
+            op.key_index = new_key_info(bucket_id);
+        }
+        if(unlikely(op.key_index == index.null_id))
+            break;
+        ++n_key;
+    }
+
+    auto give_back_keys = [this , &ops , &bucket , bucket_id , key_seq , n_key](){
+        //reused heads go back to the free list , fresh ones back to the sequence
+        const auto fresh_beg = bucket_id * layout.n_key_per_bk + key_seq;
+        const auto fresh_end = bucket_id * layout.n_key_per_bk + bucket.keys.low();
+        for(uint32_t i = 0 ; i < n_key ; ++i){
+            auto & op = ops[i];
+            if(op.is_new && (op.key_index < fresh_beg || op.key_index >= fresh_end))
+                bucket.free_keys.push_back(op.key_index);
+        }
+        bucket.keys.set_low(key_seq);
+    };
+    if(unlikely(n_key != ops.size())){
+        give_back_keys();
+        return OutOfMemory;
+    }
+
+    //in index order , so that two batches never wait on each other
+    std::vector<uint32_t> locked(ops.size());
+    std::transform(ops.begin() , ops.end() , locked.begin() , [](const batch_op & op){ return op.key_index; });
+    std::sort(locked.begin() , locked.end());
+    for(auto key_index : locked)
+        lock_key(key_index);
+
+    //a head found before it was locked may have been deleted or reused
+    for(auto & op : ops){
+        if(likely(op.is_new || holds_key(file.key_head(op.key_index) , op.key->data())))
+            continue;
+        for(auto key_index : locked)
+            unlock_key(key_index);
+        give_back_keys();
+        return NotFound;
+    }
+
+    uint32_t n_alloc{0};
+    for(auto & op : ops){
+        const uint32_t copy = op.is_new ? 0 : !file.key_head(op.key_index).index_flag;
+        op.block = place_value(bucket_id , op.key_index , copy , op.stored , op.value->size());
+        if(unlikely(is_invalid_block(op.block)))
+            break;
+        ++n_alloc;
+    }
+
+    if(unlikely(n_alloc != ops.size())){
+        for(uint32_t i = 0 ; i < n_alloc ; ++i)
+            recollect_value_blocks(bucket_id , ops[i].block , ops[i].value->size());
+        for(auto key_index : locked)
+            unlock_key(key_index);
+        give_back_keys();
+        return OutOfMemory;
+    }
+
+    //values : one drain for the whole batch
+    for(auto & op : ops)
+        copy_value(op.stored , op.block);
+    #ifdef LOCAL_TEST
+    _mm_sfence();
+    #else
+    pmem_drain();
+    #endif
+
+    //heads : tagged with the batch , one drain
+    const uint32_t seq = ++bucket.batch_seq;
+    std::vector<std::pair<block_index , uint32_t>> stale{};
+    for(auto & op : ops){
+        auto * head = &file.key_head(op.key_index);
+        head_info new_head{};
+        if(op.is_new){
+            memcpy_avx_16(new_head.key , op.key->data());
+            new_head.flags = HEAD_NEW_KEY;
+        }else{
+            new_head = *head;
+            new_head.index_flag = !head->index_flag;
+            new_head.prev_len = head->value_len;
+            new_head.flags = 0;
+            stale.emplace_back(head->index[head->index_flag] , head->value_len);
+        }
+        new_head.value_len = op.value->size();
+        new_head.index[new_head.index_flag] = op.block;
+        new_head.batch_owner = bucket_id;
+        new_head.batch_seq = seq;
+
+        #ifdef LOCAL_TEST
+        memcpy(head , &new_head , sizeof(head_info));
+        #else
+        pmem_memcpy_nodrain(head , &new_head , sizeof(head_info));
+        #endif
+    }
+    #ifndef LOCAL_TEST
+    pmem_drain();
+    #endif
+
+    //commit point
+    #ifdef LOCAL_TEST
+    meta()->batch_commit[bucket_id] = seq;
+    #else
+    pmem_memcpy_persist(&meta()->batch_commit[bucket_id] , &seq , sizeof(seq));
+    #endif
+
+    for(auto & blk : stale)
+        recollect_value_blocks(bucket_id , blk.first , blk.second);
+
+    for(auto & op : ops){
+        if(op.is_new){
+            index.insert(op.hash , key_prefix(op.key->data()) , op.key_index);
+            filter.add(op.hash);
+        }
+        unlock_key(op.key_index);
+    }
+
+    return Ok;
+}
+
+NvmEngine::write_lease NvmEngine::lease_bucket(){
+    auto & info = local();
+    if(likely(info.bucket_id != lease_table::null_id))
+        return write_lease{leases.get() , info.bucket_id , false};
+
+    //kept until the thread exits , one of its own node if there is any left
+    auto bucket_id = lease_table::null_id;
+    if(numa.n_node() > 1){
+        const uint32_t node = numa.current_node();
+        bucket_id = leases->try_acquire(get_bucket_id() , numa.first(node , layout.n_bucket) , numa.first(node + 1 , layout.n_bucket));
+    }
+    if(bucket_id == lease_table::null_id)
+        bucket_id = leases->try_acquire(get_bucket_id());
+    if(likely(bucket_id != lease_table::null_id)){
+        info.bucket_id = bucket_id;
+        info.leases = leases;
+        return write_lease{leases.get() , bucket_id , false};
+    }
+
+    //more writers than partitions , wait for any one
+    while((bucket_id = leases->try_acquire(get_bucket_id())) == lease_table::null_id)
+        std::this_thread::yield();
+    return write_lease{leases.get() , bucket_id , true};
+}
+
+bool NvmEngine::switch_bucket(write_lease & lease){
+    //the exhausted partition is given up , even by its long term holder
+    lease.tried[lease.bucket_id >> 6] |= 1ull << (lease.bucket_id & 63);
+    leases->release(lease.bucket_id);
+    if(!lease.borrowed)
+        local().bucket_id = lease_table::null_id;
+
+    //any partition not tried yet , waiting a while for busy ones
+    const uint32_t from = lease.bucket_id + 1;
+    lease.bucket_id = lease_table::null_id;
+    for(uint32_t spin = 0 ; spin < SWITCH_SPIN ; ++spin){
+        bool untried = false;
+        for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+            const uint32_t id = (from + i) % layout.n_bucket;
+            if(lease.tried[id >> 6] & (1ull << (id & 63))) continue;
+            untried = true;
+            if(!leases->try_lock(id)) continue;
+
+            lease.bucket_id = id;
+            if(!lease.borrowed){
+                auto & info = local();
+                info.bucket_id = id;
+                info.leases = leases;
+            }
+            return true;
+        }
+        if(!untried) break;
+        std::this_thread::yield();
+    }
+
+    lease.borrowed = false;     //nothing left to release
+    return false;
+}
+
+Status NvmEngine::GetCacheStats(CacheStats *stats) {
+    *stats = CacheStats{};
+    for(size_t i = 0 ; i < COUNTER_STRIPE ; ++i){
+        stats->hits += counters[i].hits.load(std::memory_order_relaxed);
+        stats->misses += counters[i].misses.load(std::memory_order_relaxed);
+        stats->admitted += counters[i].admitted.load(std::memory_order_relaxed);
+        stats->rejected += counters[i].rejected.load(std::memory_order_relaxed);
+        stats->hot_hits += counters[i].hot_hits.load(std::memory_order_relaxed);
+    }
+    #ifdef THREAD_LOCAL_CACHE
+    stats->bytes = std::max<int64_t>(0 , local_cache_bytes->load(std::memory_order_relaxed));
+    stats->capacity = layout.cache_bytes;
+    #else
+    stats->bytes = shared_cache.footprint();
+    stats->capacity = shared_cache.memory_size();
+    #endif
+    return Ok;
+}
+
+Status NvmEngine::GetHotKeys(std::vector<HotKey> *keys) {
+    if(!layout.hot_keys)
+        return IOError;
+    keys->clear();
+    hot.read(local().stripe , [keys](const hot_table * table){
+        if(!table) return;
+        for(auto & e : table->all()){
+            keys->emplace_back();
+            keys->back().key.assign(e.key , KEY_SIZE);
+            keys->back().reads = e.count;
+        }
+    });
+    return Ok;
+}
+
+Status NvmEngine::Compact() {
+    compact();
+    return Ok;
+}
+
+uint32_t NvmEngine::compact(){
+    std::lock_guard<std::mutex> guard(compact_mutex);
+
+    //the partition with the most free space scattered in runs
+    uint32_t target = 0 , most = 0;
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+        std::lock_guard<spin_lock> bucket_guard(bucket_infos[i].alloc_lock);
+        const uint32_t n = bucket_infos[i].allocator.free_block_num();
+        if(n > most) target = i , most = n;
+    }
+    return most ? compact_partition(target) : 0;
+}
+
+//once , before the first pass : owners of the blocks live heads hold.
+//writers note their own from the moment owners_on is seen , the ones
+//before are in their heads once the key is unlocked. a slot a writer
+//noted meanwhile is newer , so an owner from a head only fills an empty one
+void NvmEngine::find_owners(){
+    if(owners_on.load())
+        return;
+    auto arr = new uint32_t[layout.n_value];
+    memset(arr , 0xff , sizeof(uint32_t) * layout.n_value);
+    block_owner.reset(reinterpret_cast<std::atomic<uint32_t> *>(arr));
+    owners_on.store(true);
+
+    for(uint32_t key_index = 0 ; key_index < layout.n_key ; ++key_index){
+        head_info head;
+        uint32_t ver;
+        do{
+            ver = stable_ver(key_index);
+            head = file.key_head(key_index);
+        }while(!unchanged(key_index , ver));
+        if(is_empty_head(head) || (head.flags & HEAD_TOMBSTONE))
+            continue;
+        for_each_run(head.index[head.index_flag] , head.value_len , [this , key_index](uint32_t addr , uint32_t n){
+            for(uint32_t i = 0 ; i < n ; ++i){
+                uint32_t empty = index.null_id;
+                block_owner[addr + i].compare_exchange_strong(empty , key_index , std::memory_order_relaxed);
+            }
+        });
+    }
+}
+
+uint32_t NvmEngine::compact_partition(uint32_t bucket_id){
+    auto & bucket = bucket_infos[bucket_id];
+    find_owners();
+    const uint32_t beg = bucket_id * layout.n_block_per_bk;
+
+    //the window is the top of the used space , small enough that its live
+    //values surely fit in the free runs out of it
+    uint32_t win_beg , win_end;
+    {
+        std::lock_guard<spin_lock> guard(bucket.alloc_lock);
+        win_end = bucket.allocator.tail();
+        const uint32_t size = std::min(win_end - beg , bucket.allocator.free_block_num() / 2) & ~1u;
+        if(size < COMPACT_MIN)
+            return 0;
+        win_beg = win_end - size;
+        retiring.beg.store(win_beg);
+        retiring.end.store(win_end);
+    }
+
+    //blocks taken from now on are out of the window , and the owner of every
+    //block in it is known : noted under the alloc_lock before the window was
+    //set , or by find_owners. an owner may be stale , its head is checked
+    //under the key below
+    std::vector<uint32_t> movers{};
+    for(uint32_t addr = win_beg ; addr < win_end ; ++addr){
+        const uint32_t key_index = block_owner[addr].load(std::memory_order_relaxed);
+        if(key_index != index.null_id && (movers.empty() || movers.back() != key_index))
+            movers.push_back(key_index);
+    }
+    std::sort(movers.begin() , movers.end());
+    movers.erase(std::unique(movers.begin() , movers.end()) , movers.end());
+
+    //each value is moved like an update , its old blocks are dropped by the window
+    std::vector<uint32_t> stuck{};
+    std::string buf{};
+    for(auto key_index : movers){
+        lock_key(key_index);
+        auto & head = file.key_head(key_index);
+        if(is_empty_head(head) || (head.flags & HEAD_TOMBSTONE) || !overlaps_window(head)){
+            unlock_key(key_index);
+            continue;
+        }
+
+        //moved as stored , compressed or not
+        const auto & old_block = head.index[head.index_flag];
+        buf.resize(stored_len(old_block , head.value_len));
+        auto block = place_value(bucket_id , key_index , !head.index_flag , Slice{&buf[0] , buf.size()} , head.value_len , false);
+        if(unlikely(is_invalid_block(block))){
+            stuck.push_back(key_index);
+            unlock_key(key_index);
+            continue;
+        }
+        copy_stored(head , &buf[0]);
+
+        auto new_head = head;
+        new_head.index_flag = !head.index_flag;
+        new_head.index[new_head.index_flag] = block;
+        new_head.flags = 0;
+        new_head.batch_seq = 0;
+        write_value(Slice{&buf[0] , buf.size()} , new_head.index[!new_head.index_flag] , block);
+        recollect_value_blocks(bucket_id , head.index[head.index_flag] , head.value_len);
+
+        #ifdef LOCAL_TEST
+        memcpy(&head , &new_head , sizeof(head_info));
+        #else
+        pmem_memcpy_persist(&head , &new_head , sizeof(head_info));
+        #endif
+        unlock_key(key_index);
+    }
+
+    //no free list keeps a run of the window any more
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+        std::lock_guard<spin_lock> guard(bucket_infos[i].alloc_lock);
+        bucket_infos[i].allocator.purge();
+    }
+
+    //values which found no room stay , held so that none is freed
+    //into the window before it is closed
+    std::vector<std::pair<uint32_t , uint32_t>> live{};
+    for(auto key_index : stuck){
+        lock_key(key_index);
+        auto & head = file.key_head(key_index);
+        if(is_empty_head(head) || (head.flags & HEAD_TOMBSTONE)) continue;
+        for_each_run(head.index[head.index_flag] , head.value_len , [this , &live](uint32_t addr , uint32_t n){
+            if(retiring.overlaps(addr , n))
+                live.emplace_back(addr , n);
+        });
+    }
+    std::sort(live.begin() , live.end());
+
+    uint32_t n_freed = 0;
+    {
+        std::lock_guard<spin_lock> guard(bucket.alloc_lock);
+        retiring.end.store(0);
+        retiring.beg.store(0);
+
+        if(live.empty() && bucket.allocator.tail() == win_end){
+            bucket.allocator.shrink(win_beg);
+            n_freed = win_end - win_beg;
+        }else{
+            uint32_t gap = win_beg;
+            for(auto & run : live){
+                if(gap < run.first){
+                    bucket.allocator.recollect_gap(gap , run.first - gap);
+                    n_freed += run.first - gap;
+                }
+                gap = std::max(gap , run.first + run.second);
+            }
+            if(gap < win_end){
+                bucket.allocator.recollect_gap(gap , win_end - gap);
+                n_freed += win_end - gap;
+            }
+        }
+    }
+
+    for(auto key_index : stuck)
+        unlock_key(key_index);
+    return n_freed;
+}
+
 uint32_t NvmEngine::search(const Slice & key , uint64_t hash){
-    const auto prefix = *reinterpret_cast<const uint32_t *>(key.data());
-    return index.search(hash , prefix ,[this , &key](uint32_t key_id ){
-        return fast_key_cmp_eq(file.key_heads[key_id].key , key.data());
+    return index.search(hash , key_prefix(key.data()) ,[this , &key](uint32_t key_id ){
+        return fast_key_cmp_eq(file.key_head(key_id).key , key.data());
     });
 }
 
-uint32_t NvmEngine::search_get(const Slice & key , uint64_t hash , lru_cache_t & cache){
-    const auto prefix = *reinterpret_cast<const uint32_t *>(key.data());
-    return index.search(hash , prefix ,[this , &key , &cache](uint32_t key_id ){
-        auto info = cache.get(key_id);
-        if(info)    
-            return fast_key_cmp_eq(info->key , key.data());
+uint32_t NvmEngine::search_get(const Slice & key , uint64_t hash , value_cache_t & cache){
+    //most absent keys stop here , before any probe or key read
+    if(!filter.may_contain(hash))
+        return index.null_id;
+    return index.search(hash , key_prefix(key.data()) ,[this , &key , &cache](uint32_t key_id ){
+        //a stale entry may belong to a deleted key whose head was reused
+        char cached[KEY_SIZE];
+        if(cache.get(key_id , ver_seq[key_id].load(std::memory_order_relaxed) , [&cached](const char * k , uint32_t) -> char * {
+            memcpy_avx_16(cached , k);
+            return nullptr;
+        }))
+            return fast_key_cmp_eq(cached , key.data());
         else        
-            return fast_key_cmp_eq(file.key_heads[key_id].key , key.data());
+            return fast_key_cmp_eq(file.key_head(key_id).key , key.data());
     });
 }
 
 
-Status NvmEngine::update(const Slice & value , uint64_t hash , uint32_t key_index , uint32_t bucket_id){
+//NotFound if the head no longer holds key
+Status NvmEngine::update(const Slice & key , const Slice & value , const Slice & stored , uint64_t hash , uint32_t key_index , uint32_t bucket_id){
 
-    auto block = alloc_value_blocks(bucket_id , value.size());
-    if(unlikely(is_invalid_block(block)))
+    lock_key(key_index);
+    auto * head = &file.key_head(key_index);
+    if(unlikely(!holds_key(*head , key.data()))){
+        unlock_key(key_index);
+        return NotFound;
+    }
+    auto block = place_value(bucket_id , key_index , !head->index_flag , stored , value.size());
+    if(unlikely(is_invalid_block(block))){
+        unlock_key(key_index);
         return OutOfMemory;
-
-    auto * head = &file.key_heads[key_index];
+    }
 
     auto new_head = *head ; 
     new_head.index_flag = !head->index_flag;
     new_head.value_len = value.size();
     new_head.index[new_head.index_flag] = block;
-    
-    write_value(value , head->index[new_head.index_flag] , block);
-    recollect_value_blocks(bucket_id , head->index[head->index_flag] , head->value_len);
+    new_head.flags = 0;
+    new_head.batch_seq = 0;
 
-    //head info = 64 , directly flush whole head info
-    #ifdef LOCAL_TEST
-    // memcpy(&(head->index_flag) , &new_head.index_flag , 8);
-    memcpy(head , &new_head , sizeof(head_info));
-    #else
-    // pmem_memcpy_persist(&(head->index_flag) , &new_head.index_flag , 8);
-    pmem_memcpy_persist(head , &new_head , sizeof(head_info));
-    #endif
+    //the old copy is freed only once the new head is durable
+    auto old_block = head->index[head->index_flag];
+    const auto old_len = head->value_len;
+    commit_value(*head , new_head , stored);
+    recollect_value_blocks(bucket_id , old_block , old_len);
 
-    ver_seq[key_index].fetch_add(1 , std::memory_order_relaxed);
+    unlock_key(key_index);
     return Ok;
 }
 
-Status NvmEngine::append(const Slice & key , const Slice & value , uint64_t hash , uint32_t bucket_id){
+Status NvmEngine::append(const Slice & key , const Slice & value , const Slice & stored , uint64_t hash , uint32_t bucket_id){
+
+    //the head is held before its blocks are taken , see compact_partition
     uint32_t key_index = new_key_info(bucket_id);
+    if(unlikely(key_index == index.null_id))
+        return OutOfMemory;
 
-    //allocated seq and space
-    auto block = alloc_value_blocks(bucket_id , value.size());
-    if(unlikely(is_invalid_block(block)))
+    lock_key(key_index);
+    auto block = place_value(bucket_id , key_index , 0 , stored , value.size());
+    if(unlikely(is_invalid_block(block))){
+        unlock_key(key_index);
+        give_back_key(bucket_id , key_index);
         return OutOfMemory;
+    }
     
     //prepare key
-    auto & new_head = file.key_heads[key_index];
+    auto & new_head = file.key_head(key_index);
     head_info head{};
     head.index_flag = false;
     head.value_len = value.size();
     memcpy_avx_16(head.key , key.data());
     head.index[0] = block;
 
-    write_value(value , new_head.index[0] , block);
-
-    #ifdef LOCAL_TEST
-    memcpy(&new_head , &head , sizeof(head_info));
-    #else
-    pmem_memcpy_persist(&new_head , &head , sizeof(head_info));
-    #endif
+    commit_value(new_head , head , stored);
 
     const auto prefix = *reinterpret_cast<const uint32_t * >(key.data());
     index.insert(hash , prefix ,key_index);
-    bitset.set(hash % bitset.max_index);
+    filter.add(hash);
+    unlock_key(key_index);
     return Ok;
 }
 
-block_index NvmEngine::alloc_value_blocks(uint32_t bucket_id , uint32_t len){
-
+block_index NvmEngine::alloc_value_blocks(uint32_t bucket_id , uint32_t key_index , uint32_t len , bool fresh){
+    auto & bucket = bucket_infos[bucket_id];
+    const auto n = run_blocks(len);
     block_index block{};
+    std::lock_guard<spin_lock> guard(bucket.alloc_lock);
+    block[0] = bucket.allocator.allocate(n , fresh);
+    block[1] = BLOCK_RUN;
+    //out of space , fresh blocks of another partition before giving up
+    while(unlikely(is_invalid_block(block)) && fresh && borrow_blocks(bucket_id))
+        block[0] = bucket.allocator.allocate(n , fresh);
+    if(likely(!is_invalid_block(block)))
+        note_owner(block[0] , n , key_index);
+    return block;
+}
 
-    static_assert(sizeof(value_block) == 128 , "");
-    auto n_block = (len >> 7) + 1;
-
-    uint off = 0;
-    switch(n_block >> 1){
-    case 4:         block[3] = bucket_infos[bucket_id].allocator.allocate_256(); //8
-    case 3: ++off;  block[2] = bucket_infos[bucket_id].allocator.allocate_256(); //6,7
-    case 2: ++off;  block[1] = bucket_infos[bucket_id].allocator.allocate_256(); //4,5
-    case 1: ++off;  block[0] = bucket_infos[bucket_id].allocator.allocate_256(); //2,3
-    default:break;
+//where a value laid as stored goes : a copy of its key slot if it fits ,
+//else blocks , [2] tells a compressed one
+block_index NvmEngine::place_value(uint32_t bucket_id , uint32_t key_index , uint32_t copy , const Slice & stored , uint32_t len , bool fresh){
+    if(file.inline_cap() && stored.size() == len && len <= file.inline_cap()){
+        block_index block{};
+        block[0] = key_index;
+        block[1] = BLOCK_INLINE;
+        block[2] = copy;
+        return block;
     }
 
-    if(likely(n_block & 1))
-        block[off] = bucket_infos[bucket_id].allocator.allocate_128();
-
+    auto block = alloc_value_blocks(bucket_id , key_index , stored.size() , fresh);
+    if(stored.size() != len && likely(!is_invalid_block(block)))
+        block[2] = stored.size();
     return block;
 }
 
-void NvmEngine::recollect_value_blocks(uint32_t bucket_id , block_index & block, uint32_t len){
+//the value itself , or compressed into buf when that saves a block
+Slice NvmEngine::pack_value(const Slice & value , std::string & buf){
+    const uint32_t n = value.size();
+    if(likely(!layout.compress_threshold) || n < layout.compress_threshold || run_blocks(n) == 1)
+        return value;
+    buf.resize((run_blocks(n) - 1) * sizeof(value_block));
+    const auto packed = lz_codec::compress(value.data() , n , &buf[0] , buf.size());
+    return packed ? Slice{&buf[0] , packed} : value;
+}
+
+//only from partitions in use , a free one is better taken by switch_bucket.
+//under the alloc_lock of bucket_id , the lender is never locked
+bool NvmEngine::borrow_blocks(uint32_t bucket_id){
+    for(uint32_t i = 1 ; i < layout.n_bucket ; ++i){
+        const auto lender = (bucket_id + i) % layout.n_bucket;
+        if(!leases->is_leased(lender)) continue;
+        const auto addr = bucket_infos[lender].allocator.lend(VALUE_CHUNK);
+        if(addr == value_block_allocator::null_index) continue;
+        bucket_infos[bucket_id].allocator.recollect_gap(addr , VALUE_CHUNK);
+        return true;
+    }
+    return false;
+}
 
-    static_assert(sizeof(value_block) == 128 , "");
-    const auto n_block = (len >> 7) + 1;
-    uint off = 0;
-    switch(n_block >> 1){
-    case 4:         bucket_infos[bucket_id].allocator.recollect_256(block[3]); //8
-    case 3: ++off;  bucket_infos[bucket_id].allocator.recollect_256(block[2]); //6,7
-    case 2: ++off;  bucket_infos[bucket_id].allocator.recollect_256(block[1]); //4,5
-    case 1: ++off;  bucket_infos[bucket_id].allocator.recollect_256(block[0]); //2,3
-    default:break;
+//by the leaseholder of bucket_id , a chunk of fresh heads of another partition
+uint32_t NvmEngine::borrow_keys(uint32_t bucket_id){
+    const auto chunk = key_chunk();
+    for(uint32_t i = 1 ; i < layout.n_bucket ; ++i){
+        const auto lender = (bucket_id + i) % layout.n_bucket;
+        if(!leases->is_leased(lender)) continue;
+        const auto off = bucket_infos[lender].keys.take_top(chunk);
+        if(off == split_range::null_off) continue;
+
+        //persisted before any head in it is written , recovery scans lent chunks whole
+        mark_keys_lent(lender , (layout.n_key_per_bk - off) / chunk);
+        const auto beg = lender * layout.n_key_per_bk + off;
+        auto & free_keys = bucket_infos[bucket_id].free_keys;
+        for(uint32_t k = chunk - 1 ; k > 0 ; --k)
+            free_keys.push_back(beg + k);
+        return beg;
     }
+    return index.null_id;
+}
+
+void NvmEngine::mark_keys_lent(uint32_t bucket_id , uint16_t n_chunk){
+    auto & lent = meta()->keys_lent[bucket_id];
+    uint16_t cur = __atomic_load_n(&lent , __ATOMIC_RELAXED);
+    while(cur < n_chunk && !__atomic_compare_exchange_n(&lent , &cur , n_chunk , true , __ATOMIC_RELAXED , __ATOMIC_RELAXED));
+
+    #ifndef LOCAL_TEST
+    pmem_persist(&lent , sizeof(lent));
+    #endif
+}
 
-    if(n_block & 1)
-        bucket_infos[bucket_id].allocator.recollect_128(block[off]);
+void NvmEngine::recollect_value_blocks(uint32_t bucket_id , block_index & block, uint32_t len){
+    auto & allocator = bucket_infos[bucket_id].allocator;
+    std::lock_guard<spin_lock> guard(bucket_infos[bucket_id].alloc_lock);
+    for_each_run(block , len , [&allocator](uint32_t addr , uint32_t n){
+        allocator.recollect(addr , n);
+    });
 }
 
 void NvmEngine::write_value(const Slice & value , block_index & block ,block_index & indics ){
+    copy_value(value , indics);
 
     #ifdef LOCAL_TEST
-    #define MEMCPY memcpy
+    _mm_sfence();
     #else
-    #define MEMCPY pmem_memcpy_nodrain
+    pmem_drain();
     #endif
-    
-    static_assert(sizeof(value_block) == 128 , "");
-    // const uint n_block = value.size() / sizeof(value_block) + 1;
-    const uint n_block = (value.size() >> 7) + 1;
-    uint off = 0;
-    switch(n_block){
-    case 8 :
-    case 7 : ++off ; MEMCPY(&file.value_blocks[indics[2]] , value.data() + 512 , 256);
-    case 6 :
-    case 5 : ++off ; MEMCPY(&file.value_blocks[indics[1]] , value.data() + 256 , 256);
-    case 4 : 
-    case 3 : ++off ; MEMCPY(&file.value_blocks[indics[0]] , value.data() , 256);
-    default:break;
-    }
-
-    uint res_len = value.size() & (n_block & 1 ? 127 : 255);
-    MEMCPY(&file.value_blocks[indics[off]] , value.data() + off * 256 , res_len);
+}
 
-    #ifndef LOCAL_TEST
+//writes the value , then the head over the current one. the value is
+//drained before the head is persisted , or in checksum mode both go
+//with non-temporal stores and one fence , the head carrying the CRC32C
+//of both copies so that recovery can tell a torn write and fall back
+void NvmEngine::commit_value(head_info & head , head_info & new_head , const Slice & stored){
+    auto & block = new_head.index[new_head.index_flag];
+    if(!layout.checksum_writes){
+        write_value(stored , block , block);
+
+        #ifdef LOCAL_TEST
+        memcpy(&head , &new_head , sizeof(head_info));
+        #else
+        pmem_memcpy_persist(&head , &new_head , sizeof(head_info));
+        #endif
+        return;
+    }
+
+    auto & old = new_head.index[!new_head.index_flag];
+    if(is_block_run(old) || is_inline(old)){
+        new_head.prev_len = head.value_len;
+        if(!(head.flags & HEAD_CRC))
+            old[3] = copy_crc(head.key , head.value_len , Slice{value_addr(old) , stored_len(old , head.value_len)});
+    }
+    new_head.flags |= HEAD_CRC;
+    block[3] = copy_crc(new_head.key , new_head.value_len , stored);
+
+    copy_value(stored , block);
+    #ifdef LOCAL_TEST
+    memcpy(&head , &new_head , sizeof(head_info));
+    _mm_sfence();
+    #else
+    pmem_memcpy(&head , &new_head , sizeof(head_info) , PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
     pmem_drain();
     #endif
+}
 
-    #undef MEMCPY
+//whether a copy points inside the file and matches its CRC32C
+bool NvmEngine::copy_intact(uint32_t key_index , const head_info & head , uint32_t copy , uint32_t len){
+    auto & block = head.index[copy];
+    const auto n = stored_len(block , len);
+    if(is_inline(block)){
+        if(block[0] != key_index || block[2] != copy || n > file.inline_cap())
+            return false;
+    }else if(!is_block_run(block) || n > MAX_STORED
+        || block[0] >= layout.n_value || run_blocks(n) > layout.n_value - block[0])
+        return false;
+    return block[3] == copy_crc(head.key , len , Slice{value_addr(block) , n});
 }
 
-void NvmEngine::read_value(const Slice & key ,std::string & value , uint32_t key_index , lru_cache_t & cache){
+void NvmEngine::copy_value(const Slice & value , block_index & indics){
+    //whole lines with the host's widest streaming stores , the ragged
+    //ends of a run or an inline slot through the cache
+    auto * dst = value_addr(indics);
+    #ifdef LOCAL_TEST
+    stream_copy(dst , value.data() , value.size());
+    #else
+    stream_copy(dst , value.data() , value.size() , [](char * d , const char * s , size_t n){
+        pmem_memcpy_nodrain(d , s , n);
+    });
+    #endif
+}
 
-    auto info = cache.get(key_index);
-    if(likely(info && info->ver == ver_seq[key_index].load(std::memory_order_relaxed))){
-        value = info->value;
-    }else{
+uint32_t NvmEngine::value_pieces(const head_info & head , Slice * pieces){
+    auto & block = head.index[head.index_flag];
+    if(likely(is_block_run(block) || is_inline(block))){
+        pieces[0] = Slice{value_addr(block) , stored_len(block , head.value_len)};
+        return 1;
+    }
 
-    auto & head = file.key_heads[key_index];
+    const uint n_256 = head.value_len >> 8 , res_len = head.value_len & 255;
+    for(uint i = 0 ; i < n_256 ; ++i)
+        pieces[i] = Slice{reinterpret_cast<char *>(&file.value_blocks[block[i]]) , 256};
+    if(res_len == 0 && n_256)
+        return n_256;
+    pieces[n_256] = Slice{reinterpret_cast<char *>(&file.value_blocks[block[n_256]]) , res_len};
+    return n_256 + 1;
+}
 
+//false if packed blocks do not decode to the value , media damage or a
+//copy taken while a writer reused them , the caller tells by ver_seq
+bool NvmEngine::copy_blocks(const head_info & head , char * buf){
     auto & block = head.index[head.index_flag];
-    // uint n_256 = (head->value_len / sizeof(value_block))/2; //0 1 2 3
-    const uint n_256 = head.value_len >> 8;
+    if(unlikely(is_packed(block)))
+        return lz_codec::decompress(value_addr(block) , block[2] , buf , head.value_len);
+    copy_stored(head , buf);
+    return true;
+}
 
-    value.clear();
-    value.reserve(head.value_len);
-    uint res_len = head.value_len;
-    for(uint i = 0; i < n_256; ++i , res_len -= 256){
-        value.append(reinterpret_cast<const char *>(&file.value_blocks[block[i]]) , 256);
+//bytes as laid in the blocks
+void NvmEngine::copy_stored(const head_info & head , char * buf){
+    std::array<Slice , PinnedValue::kMaxPieces> pieces;
+    const auto n = value_pieces(head , pieces.data());
+    for(uint32_t i = 0 ; i < n ; buf += pieces[i].size() , ++i)
+        memcpy(buf , pieces[i].data() , pieces[i].size());
+}
+
+//the hottest sampled keys with their values as of now , published whole.
+//a value is read like a seqlock : ver_seq even and unchanged around it.
+//background thread only
+void NvmEngine::refresh_hot(){
+    //samples left since the last round , those overwritten are lost
+    uint32_t n_sample = 0;
+    for(size_t i = 0 ; i < COUNTER_STRIPE ; ++i){
+        auto & ring = samples[i];
+        const uint32_t end = ring.pos.load(std::memory_order_acquire);
+        //two writers of a stripe may step pos back , nothing new then
+        if(int32_t(end - ring.taken) < 0)
+            ring.taken = end;
+        for(uint32_t pos = end - ring.taken > HOT_RING ? end - HOT_RING : ring.taken ; pos != end ; ++pos , ++n_sample)
+            hot_top->record(ring.keys[pos % HOT_RING].load(std::memory_order_relaxed));
+        ring.taken = end;
+    }
+    if(!n_sample)
+        return;
+
+    std::unique_ptr<hot_table> table(new hot_table{});
+    std::string buf{};
+    for(auto & item : hot_top->top(layout.hot_keys)){
+        const uint32_t key_index = item.key_index;
+        const uint32_t ver = ver_seq[key_index].load(std::memory_order_acquire);
+        const head_info head = file.key_head(key_index);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if((ver & 1) || ver_seq[key_index].load(std::memory_order_relaxed) != ver
+            || is_empty_head(head) || (head.flags & HEAD_TOMBSTONE) || head.value_len > hot_table::max_value)
+            continue;
+
+        buf.resize(head.value_len);
+        const bool intact = copy_blocks(head , &buf[0]);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(intact && ver_seq[key_index].load(std::memory_order_relaxed) == ver)
+            table->add(head.key , key_index , ver , item.count , buf.data() , buf.size());
     }
-    value.append(reinterpret_cast<const char *>(&file.value_blocks[block[n_256]]) , res_len);
+    table->seal();
+    hot.publish(std::move(table));
+}
 
-    cache.put(key_index , cache_info{key.data() , ver_seq[key_index].load(std::memory_order_relaxed) ,value});
+//NotFound if the head no longer holds key , IOError if its value does not
+//decode. a value is read like a seqlock : ver_seq even and unchanged
+//around the copy , else it is read again
+Status NvmEngine::read_value(const Slice & key ,std::string & value , uint32_t key_index , value_cache_t & cache){
+
+    for(;;){
+        //an entry of this ver may belong to the key the head was reused for
+        uint32_t ver = stable_ver(key_index);
+        bool same{true};
+        if(likely(cache_get(cache , key_index , ver , [&value , &key , &same](const char * k , uint32_t n) -> char * {
+            if(!(same = fast_key_cmp_eq(k , key.data())))
+                return nullptr;
+            value.resize(n);
+            return &value[0];
+        })))
+            return same ? Ok : NotFound;
+
+        head_info head;
+        if(unlikely(!read_head(key_index , key.data() , head , ver)))
+            return NotFound;
+        value.resize(head.value_len);
+        const bool intact = copy_blocks(head , &value[0]);
+        if(likely(unchanged(key_index , ver))){
+            if(unlikely(!intact))
+                return IOError;
+            cache_put(cache , key_index , ver , key.data() , value.data() , value.size());
+            return Ok;
+        }
     }
 }
 
 
 void NvmEngine::recovery(){
 
-    std::array< std::thread  , BUCKET_CNT> ts;
-    
-    using max_off_array_t = std::array<uint32_t , BUCKET_CNT> ;
-    max_off_array_t final_off{};
-
-    std::vector<std::future<max_off_array_t>> grid{};
-
-    for(uint i = 0 ; i < BUCKET_CNT ; ++i){
-        grid.emplace_back(std::async([this , i]() -> max_off_array_t {
+    using max_off_array_t = std::vector<uint32_t> ;
+    max_off_array_t final_off(layout.n_bucket);
 
-            max_off_array_t result{};
+    //blocks referenced by live heads , a value may sit in any partition
+    bitmap_filter used{layout.n_value};
 
-            //read head and build index
-            for(uint j = 0 ; j < N_KEY / BUCKET_CNT ; ++j){
-                auto key_index = new_key_info(i);
-                auto & head = file.key_heads[key_index];
+    std::vector<std::future<max_off_array_t>> grid{};
 
-                //last invalid value
-                if(head.value_len == 0){
-                    --bucket_infos[i].key_seq ;
-                    break;
+    for(uint i = 0 ; i < layout.n_bucket ; ++i){
+        grid.emplace_back(std::async([this , i , &used]() -> max_off_array_t {
+
+            max_off_array_t result(layout.n_bucket);
+            auto & bucket = bucket_infos[i];
+
+            //live keys are hashed side by side , a group at a time
+            std::array<uint32_t , RECOVER_GROUP> live;
+            std::array<const char * , RECOVER_GROUP> ptrs;
+            std::array<uint64_t , RECOVER_GROUP> hashes;
+            uint32_t n_live = 0;
+            auto insert_live = [this , &live , &ptrs , &hashes , &n_live](){
+                hash_bytes_16_n(ptrs.data() , n_live , hashes.data());
+                for(uint32_t k = 0 ; k < n_live ; ++k){
+                    index.insert(hashes[k] , key_prefix(ptrs[k]) , live[k]);
+                    filter.add(hashes[k]);
+                }
+                n_live = 0;
+            };
+
+            //rebuilds the index from one head , false if it was never written
+            auto recover_head = [this , &bucket , &result , &used , &live , &ptrs , &n_live , &insert_live](uint32_t key_index){
+                auto & head = file.key_head(key_index);
+                if(is_empty_head(head))
+                    return false;
+
+                //written in one fence , a torn copy falls back to the one before
+                if(unlikely((head.flags & HEAD_CRC) && !(head.flags & HEAD_TOMBSTONE)
+                    && !copy_intact(key_index , head , head.index_flag , head.value_len))){
+                    if(copy_intact(key_index , head , !head.index_flag , head.prev_len))
+                        rollback_batch_head(head);
+                    else
+                        persist_tombstone(head);
                 }
 
-                auto & block_ids = head.index[head.index_flag];
+                //written by a batch which never committed
+                if(unlikely(!(head.flags & HEAD_TOMBSTONE) 
+                    && head.batch_seq > meta()->batch_commit[head.batch_owner])){
+                    if(head.flags & HEAD_NEW_KEY)
+                        persist_tombstone(head);
+                    else
+                        rollback_batch_head(head);
+                }
 
-                for(auto value_id : block_ids){
-                    constexpr uint n_block_per_bk = decltype(bucket_info::allocator)::total_block_num;
-                    uint correspond_bk = value_id / n_block_per_bk;
-                    uint off = value_id - correspond_bk * n_block_per_bk;
-                    result[correspond_bk]= std::max(result[correspond_bk], off);
+                if(head.flags & HEAD_TOMBSTONE){
+                    bucket.free_keys.push_back(key_index);
+                    return true;
                 }
 
-                auto prefix = * reinterpret_cast<const uint32_t *>(head.key); 
-                auto hash = hash_bytes_16(head.key);
-                index.insert(hash , prefix, key_index);
-            }
+                //end of the space used , per partition
+                for_each_run(head.index[head.index_flag] , head.value_len , [this , &result , &used](uint32_t value_id , uint32_t n){
+                    const uint correspond_bk = value_id / layout.n_block_per_bk;
+                    const uint end = value_id - correspond_bk * layout.n_block_per_bk + n;
+                    result[correspond_bk] = std::max(result[correspond_bk] , end);
+                    for(uint32_t k = 0 ; k < n ; ++k)
+                        used.set(value_id + k);
+                });
+
+                live[n_live] = key_index;
+                ptrs[n_live] = head.key;
+                if(++n_live == RECOVER_GROUP)
+                    insert_live();
+                return true;
+            };
+
+            //fresh heads are taken in order , the first empty one ends them
+            const uint32_t base = i * layout.n_key_per_bk;
+            const uint32_t lent_beg = layout.n_key_per_bk 
+                - std::min(layout.n_key_per_bk , meta()->keys_lent[i] * key_chunk());
+            uint32_t seq = 0;
+            while(seq < lent_beg && recover_head(base + seq))
+                ++seq;
+
+            //chunks lent to other partitions fill up in any order
+            for(uint32_t j = lent_beg ; j < layout.n_key_per_bk ; ++j)
+                if(!recover_head(base + j))
+                    bucket.free_keys.push_back(base + j);
+            insert_live();
+            bucket.keys.init(seq , lent_beg);
 
             return result;
         }));
@@ -314,24 +1283,174 @@ void NvmEngine::recovery(){
         }
     }
 
-    //retrive offset with some waste
-    for(uint32_t i = 0 ; i < BUCKET_CNT ; ++i ){
-        auto & allocator = bucket_infos[i].allocator;
-        allocator.init( i * allocator.total_block_num , final_off[i] + 2);
+    //fresh space of each partition starts after its last used block ,
+    //every gap below it goes back to the free runs
+    std::vector<std::future<void>> gaps{};
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i ){
+        gaps.emplace_back(std::async([this , i , &final_off , &used](){
+            auto & allocator = bucket_infos[i].allocator;
+            const uint32_t beg = i * layout.n_block_per_bk;
+            const uint32_t tail = std::min(final_off[i] + (final_off[i] & 1) , layout.n_block_per_bk);
+            allocator.init(beg , tail , layout.n_block_per_bk);
+
+            uint32_t gap = 0;
+            for(uint32_t off = 0 ; off < tail ; ++off){
+                if(!used.test(beg + off)) continue;
+                if(gap < off) allocator.recollect_gap(beg + gap , off - gap);
+                gap = off + 1;
+            }
+            if(gap < tail) allocator.recollect_gap(beg + gap , tail - gap);
+
+            bucket_infos[i].batch_seq = meta()->batch_commit[i];
+        }));
     }
+    for(auto & f : gaps)
+        f.get();
 
     // uint32_t n_retrive = std::accumulate(
     //     bucket_infos.begin() , bucket_infos.end() , 0 , 
-    //     [](uint32_t v , bucket_info & info){ return v + info.key_seq;}
+    //     [](uint32_t v , bucket_info & info){ return v + info.keys.low();}
     // );
 }
 
+void NvmEngine::rollback_batch_head(head_info & head){
+    //the previous copy is intact , its blocks are only recollected after commit.
+    //also undoes a torn checksummed write
+    auto old_head = head;
+    old_head.index_flag = !head.index_flag;
+    old_head.value_len = head.prev_len;
+    old_head.batch_seq = 0;
+
+    #ifdef LOCAL_TEST
+    memcpy(&head , &old_head , sizeof(head_info));
+    #else
+    pmem_memcpy_persist(&head , &old_head , sizeof(head_info));
+    #endif
+}
+
+void NvmEngine::persist_tombstone(head_info & head){
+    auto dead = head;
+    dead.flags = HEAD_TOMBSTONE;
+    dead.batch_seq = 0;
+
+    #ifdef LOCAL_TEST
+    memcpy(&head , &dead , sizeof(head_info));
+    #else
+    pmem_memcpy_persist(&head , &dead , sizeof(head_info));
+    #endif
+}
+
+void NvmEngine::init_meta(){
+    engine_meta m{};
+    m.magic = META_MAGIC;
+    m.file_size = layout.file_size;
+    m.key_area = layout.key_area;
+    m.n_bucket = layout.n_bucket;
+    m.head_size = layout.head_size;
+    m.file_id = std::random_device{}() | (uint64_t(std::random_device{}()) << 32);
+
+    #ifdef LOCAL_TEST
+    memcpy(meta() , &m , sizeof(engine_meta));
+    #else
+    pmem_memcpy_persist(meta() , &m , sizeof(engine_meta));
+    #endif
+}
+
 void NvmEngine::first_init(){
-    for(uint32_t i = 0 ; i < BUCKET_CNT ; ++i ){
-        bucket_infos[i].allocator.init(i * bucket_infos[i].allocator.total_block_num, 0);
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i ){
+        bucket_infos[i].allocator.init(i * layout.n_block_per_bk , 0 , layout.n_block_per_bk);
+        bucket_infos[i].keys.init(0 , layout.n_key_per_bk);
     }
 }
 
+bool NvmEngine::load_checkpoint(){
+    FILE * f = fopen(ckpt_name.c_str() , "rb");
+    if(!f) return false;
+    std::unique_ptr<FILE , int(*)(FILE *)> guard{f , fclose};
+
+    ckpt_header header{};
+    if(fseek(f , 0 , SEEK_END) != 0) return false;
+    const uint64_t size = ftell(f);
+    rewind(f);
+
+    //checked before anything is loaded , so a failure leaves the engine empty
+    if(!load_pod(f , &header) 
+        || header.magic != CKPT_MAGIC 
+        || header.size != size
+        || header.file_id != meta()->file_id
+        || header.gen != meta()->ckpt_gen
+        || header.n_key != layout.n_key || header.n_value != layout.n_value
+        || header.n_bucket != layout.n_bucket || header.index_kind != index_t::kind)
+        return false;
+
+    bool ok = index.load(f) && filter.load(f);
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+        auto & bucket = bucket_infos[i];
+        uint32_t key_lo{} , key_hi{};
+        ok = ok && bucket.allocator.load(f)
+            && load_pod(f , &key_lo) && load_pod(f , &key_hi) && load_pod(f , &bucket.batch_seq)
+            && load_vector(f , bucket.free_keys);
+        bucket.keys.init(key_lo , key_hi);
+    }
+    if(ok)
+        return true;
+
+    //recovery rebuilds all of it , nothing half loaded may stay
+    index.clear();
+    filter.clear();
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+        bucket_infos[i].allocator.clear();
+        bucket_infos[i].free_keys.clear();
+    }
+    return false;
+}
+
+bool NvmEngine::dump_checkpoint(){
+    FILE * f = fopen(ckpt_name.c_str() , "wb");
+    if(!f) return false;
+
+    //header goes last , a torn checkpoint never matches
+    ckpt_header header{};
+    bool ok = dump_pod(f , &header) && index.dump(f) && filter.dump(f);
+    for(uint32_t i = 0 ; i < layout.n_bucket ; ++i){
+        auto & bucket = bucket_infos[i];
+        const uint32_t key_lo = bucket.keys.low() , key_hi = bucket.keys.high();
+        ok = ok && bucket.allocator.dump(f)
+            && dump_pod(f , &key_lo) && dump_pod(f , &key_hi) && dump_pod(f , &bucket.batch_seq)
+            && dump_vector(f , bucket.free_keys);
+    }
+
+    const uint64_t size = ftell(f);
+    header = ckpt_header{CKPT_MAGIC , meta()->file_id , meta()->ckpt_gen + 1 , size , layout.n_key , layout.n_value , layout.n_bucket , index_t::kind};
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0
+        && fseek(f , 0 , SEEK_SET) == 0 && dump_pod(f , &header)
+        && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+
+    if(!ok) remove(ckpt_name.c_str());
+    return ok;
+}
+
+void NvmEngine::set_clean(bool clean){
+    auto & m = *meta();
+    if(clean) m.ckpt_gen += 1;
+    m.ckpt_clean = clean;
+
+    #ifndef LOCAL_TEST
+    pmem_persist(&m , sizeof(engine_meta));
+    #endif
+}
+
 NvmEngine::~NvmEngine() {
-    pmem_unmap(file.base() , NVM_SIZE);
+    {
+        std::lock_guard<std::mutex> guard(stop_mutex);
+        background_stop = true;
+    }
+    stop_cv.notify_all();
+    if(background.joinable())
+        background.join();
+
+    if(dump_checkpoint())
+        set_clean(true);
+    pmem_unmap(file.base() , layout.file_size);
 }
@@ -3,6 +3,9 @@
 
 #include <atomic>
 #include <climits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdlib>
 #include <iostream>
@@ -12,118 +15,588 @@
 #include "include/kvfile.hpp"
 #include "include/hash_index.hpp"
 #include "include/allocator.hpp"
+#include "include/split_range.hpp"
+#include "include/lz_codec.hpp"
 #include "include/open_address_hash_index.hpp"
+#include "include/group_hash_index.hpp"
+#include "include/growable_hash_index.hpp"
 #include "include/bloom_filter.hpp"
 #include "include/lru_cache.hpp"
+#include "include/clock_cache.hpp"
+#include "include/frequency_sketch.hpp"
+#include "include/lease_table.hpp"
+#include "include/hot_table.hpp"
+#include "include/rcu_ptr.hpp"
+#include "include/numa_topology.hpp"
 
 class NvmEngine : DB {
 public:
+
+    //runtime shape of the engine , fixed for the life of a file
+    struct layout_info{
+        size_t file_size;
+        size_t key_area;
+        uint32_t n_bucket;
+        uint32_t n_key;
+        uint32_t n_value;
+        uint32_t n_key_per_bk;
+        uint32_t n_block_per_bk;
+        uint32_t head_size;         //of a key slot , inline values included
+        size_t cache_bytes;         //DRAM of the value cache , metadata included
+        uint32_t compact_interval_ms;   //between background compactions , 0 if off
+        uint32_t compress_threshold;    //shortest value compressed , 0 if off
+        bool checksum_writes;           //value and head in one fence , see commit_value
+        uint32_t hot_keys;              //entries of the hot table , 0 if off
+        bool numa_aware;                //see lease_bucket and CreateOrOpen
+    };
+
     /**
      * @param 
      * name: file in AEP(exist)
      * dbptr: pointer of db object
+     * options: shape of a new file , an existing one keeps its own
      *
      */
-    static Status CreateOrOpen(const std::string &name, DB **dbptr);
-    NvmEngine(const std::string &name);
+    static Status CreateOrOpen(const std::string &name, DB **dbptr, const Options &options = Options{});
+    NvmEngine(const std::string &name, const layout_info &layout);
     Status Get(const Slice &key, std::string *value);
+    Status Get(const Slice &key, char *buf, size_t cap, size_t *len);
+    Status GetPinned(const Slice &key, PinnedValue *pinned);
+    bool IsPinnedValid(const PinnedValue &pinned);
     Status Set(const Slice &key, const Slice &value);
+    Status Delete(const Slice &key);
+    Status MultiGet(const Slice *keys, size_t n, std::string *values, Status *out);
+    Status Write(const WriteBatch &batch);
+    Status GetCacheStats(CacheStats *stats);
+    Status GetHotKeys(std::vector<HotKey> *keys);
+    Status Compact();
     ~NvmEngine();
 
 private:
 
     static constexpr size_t META_SIZE = 1_KB;
 
+    //shape of a file created without options
     #ifdef LOCAL_TEST
-    static constexpr size_t DRAN_SIZE = 256_MB;
     static constexpr size_t NVM_SIZE = 64_MB ;
     static constexpr size_t KEY_AREA = 14_MB;
-    static constexpr size_t VALUE_AREA = NVM_SIZE - META_SIZE - KEY_AREA ;
     #else
-    static constexpr size_t DRAM_SIZE = 8_GB;
     static constexpr size_t NVM_SIZE = 64_GB ;
     static constexpr size_t KEY_AREA = 14_GB + 256_MB ;
-    static constexpr size_t VALUE_AREA = NVM_SIZE - META_SIZE - KEY_AREA ;
-    static_assert(VALUE_AREA > 48_GB , "" );
+    #endif
+    static_assert(NVM_SIZE % 256 == 0 && KEY_AREA % (NVM_SIZE / 256) == 0 , "");
+
+    static constexpr size_t THREAD_CNT = 16;      //partitions of files without a shape in meta
+    static constexpr size_t PARTITION_CNT = 64;   //more than writer threads , so each gets its own
+    static constexpr size_t MAX_BUCKET = 128;     //bounded by engine_meta
+    static constexpr size_t SWITCH_SPIN = 1 << 14; //yields waiting for a partition to try
+    static constexpr size_t MAX_STORED = value_block_allocator::max_run * sizeof(value_block);  //one run
+
+    #if defined(GROUP_HASH_INDEX)
+    using index_t = group_address_hash;     // 2.2GB
+    #elif defined(GROWABLE_HASH_INDEX)
+    using index_t = growable_hash;          // grows up to 3.6GB
+    #else
+    using index_t = open_address_hash;      // 3.6GB
     #endif
 
-    static constexpr size_t N_KEY = KEY_AREA / sizeof(head_info) ;
-    static constexpr size_t N_VALUE = VALUE_AREA / sizeof(value_block);
-    static constexpr size_t N_IDINFO = N_KEY;
+    //keys of a MultiGet are pipelined in groups , bounded by line fill buffers
+    static constexpr size_t MULTIGET_GROUP = 16;
 
-    static constexpr size_t THREAD_CNT = 16;
-    static constexpr size_t BUCKET_CNT = THREAD_CNT;
-    static constexpr size_t HASH_SIZE = N_KEY /2;
+    //live heads found by recovery are hashed and indexed in groups
+    static constexpr size_t RECOVER_GROUP = 32;
 
-    static constexpr size_t cache_size = (N_KEY / BUCKET_CNT) / 1_KB;
+    //one read in HOT_SAMPLE is left in a ring of its stripe , the background
+    //thread feeds them to the top-K and rebuilds the hot table every
+    //HOT_INTERVAL_MS if anything was sampled
+    static constexpr uint32_t HOT_SAMPLE = 16;
+    static constexpr uint32_t HOT_RING = 256;           //power of 2
+    static constexpr uint32_t HOT_INTERVAL_MS = 20;
+    static constexpr uint32_t MAX_HOT = 1024;
+
+    //blocks a compaction window must free at least
+    static constexpr uint32_t COMPACT_MIN = 64;
+
+    //lent to a partition out of space , by another one
+    static constexpr uint32_t VALUE_CHUNK = 256;   //blocks , even
+    static constexpr uint32_t KEY_CHUNK = 64;      //heads at least , see key_chunk()
 
 public:
 
     struct alignas(CACHELINE_SIZE) bucket_info{
-        value_block_allocator<N_VALUE / BUCKET_CNT> allocator;
-        uint32_t key_seq{};
+        value_block_allocator allocator;    //under alloc_lock , the compactor reaches in too
+        spin_lock alloc_lock;
+        split_range keys;       //[next fresh head , first head lent out)
+        uint32_t batch_seq{};   //last batch written by this bucket
+        std::vector<uint32_t> free_keys{};  //tombstoned heads
+    };
+
+    //laid over file.meta
+    struct engine_meta{
+        uint64_t magic;
+        uint64_t file_size;                 //shape of the file
+        uint64_t key_area;
+        uint32_t n_bucket;
+        uint32_t ckpt_clean;                //no write since ckpt_gen was taken
+        uint64_t file_id;                   //binds checkpoints to this file
+        uint64_t ckpt_gen;                  //generation of the last checkpoint
+        uint32_t batch_commit[MAX_BUCKET];  //last committed batch of each bucket
+        uint16_t keys_lent[MAX_BUCKET];     //key chunks lent from the top of each bucket
+        uint32_t head_size;                 //of a key slot , 0 in files from before slots grew
     };
+    static_assert(sizeof(engine_meta) <= sizeof(meta_info) , "");
+    static constexpr uint64_t META_MAGIC = 0x314154454d564e54;
 
-    struct cache_info{
+    //header of the DRAM state checkpoint , written last
+    struct ckpt_header{
+        uint64_t magic;
+        uint64_t file_id;
+        uint64_t gen;
+        uint64_t size;      //of the whole checkpoint file
+        uint64_t n_key;
+        uint64_t n_value;
+        uint32_t n_bucket;
+        uint32_t index_kind;
+    };
+    static constexpr uint64_t CKPT_MAGIC = 0x54504b4335564e54;
+
+    struct cache_meta{
         char key[KEY_SIZE];
-        uint32_t ver{};
-        std::string value{};
-        
-        explicit cache_info() = default;
-
-        explicit cache_info(const char * key , uint32_t ver , const std::string & str ){
-            value = str;
-            this->ver = ver;
-            memcpy_avx_16(this->key , key);
-        }
+        uint32_t ver;
     };
 
-    using lru_cache_t = lru_cache<uint32_t , cache_info , cache_size>;
+    using lru_cache_t = lru_cache<uint32_t , cache_meta>;
+
+    #ifdef THREAD_LOCAL_CACHE
+    //every thread keeps its own copies , the budget is split among partitions
+    class value_cache_t{
+    public:
+        //footprints of all threads' caches add up in usage
+        value_cache_t(size_t budget , std::shared_ptr<std::atomic<int64_t>> usage)
+        :lru(lru_cache_t::chunks_for(budget)) , usage(std::move(usage)){
+            this->usage->fetch_add(lru.footprint() , std::memory_order_relaxed);
+        }
+
+        ~value_cache_t(){
+            usage->fetch_sub(lru.footprint() , std::memory_order_relaxed);
+        }
+
+        //same contract as clock_cache::get
+        template<class F>
+        bool get(uint32_t key_index , uint32_t ver , F && dest){
+            auto n = lru.get(key_index);
+            if(!n || n->meta.ver != ver) return false;
+            if(char * out = dest(n->meta.key , n->len))
+                lru.copy(n , out);
+            return true;
+        }
+
+        //same contract as clock_cache::put , the victim is the lru tail
+        template<class F>
+        bool put(uint32_t key_index , uint32_t ver , const char * key , const char * value , uint32_t len , F && admit){
+            auto last = lru.last();
+            if(!lru.has_room(len) && last && last->key != key_index && !admit(last->key))
+                return false;
+
+            cache_meta meta{};
+            memcpy_avx_16(meta.key , key);
+            meta.ver = ver;
+            const int64_t before = lru.footprint();
+            const bool stored = lru.put(key_index , meta , value , len);
+            usage->fetch_add(int64_t(lru.footprint()) - before , std::memory_order_relaxed);
+            return stored;
+        }
+
+    private:
+        lru_cache_t lru;
+        std::shared_ptr<std::atomic<int64_t>> usage;
+    };
+    #else
+    using value_cache_t = clock_cache<1_KB>;
+    #endif
 
 private:
 
+    //per thread , reset once the thread moves on to another engine
+    struct local_info{
+        uint64_t owner{0};
+        uint32_t bucket_id{lease_table::null_id};   //leased partition
+        uint32_t stripe{0};                         //of cache counters
+        uint32_t reads{0};                          //for sampling
+        std::shared_ptr<lease_table> leases{};
+        #ifdef THREAD_LOCAL_CACHE
+        std::unique_ptr<value_cache_t> cache{};
+        #endif
+
+        ~local_info(){
+            drop_lease();
+        }
+
+        void drop_lease(){
+            if(leases) leases->release(bucket_id);
+            bucket_id = lease_table::null_id;
+            leases.reset();
+        }
+    };
+
+    local_info & local(){
+        static thread_local local_info info;
+        if(unlikely(info.owner != instance_id)){
+            info.owner = instance_id;
+            info.stripe = stripe_seq ++ % COUNTER_STRIPE;
+            info.drop_lease();
+            #ifdef THREAD_LOCAL_CACHE
+            info.cache.reset();
+            #endif
+        }
+        return info;
+    }
+
+    //partition a write runs in : the thread's own lease , or one borrowed
+    //for this write only when every partition is leased
+    struct write_lease : disable_copy{
+        lease_table * table;
+        uint32_t bucket_id;
+        bool borrowed;
+        std::array<uint64_t , MAX_BUCKET / 64> tried{};     //exhausted for this write
+
+        write_lease(lease_table * table , uint32_t bucket_id , bool borrowed)
+        :table(table) , bucket_id(bucket_id) , borrowed(borrowed){}
+
+        write_lease(write_lease && r) noexcept
+        :table(r.table) , bucket_id(r.bucket_id) , borrowed(r.borrowed) , tried(r.tried){
+            r.borrowed = false;
+        }
+
+        ~write_lease(){
+            if(borrowed) table->release(bucket_id);
+        }
+    };
+
+    //cache counters , striped so that readers do not share a line
+    struct alignas(CACHELINE_SIZE) cache_counter{
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> admitted{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> hot_hits{0};
+    };
+    static constexpr size_t COUNTER_STRIPE = 64;
+    static constexpr size_t CACHE_VALUE_AVG = 512;     //sizes the admission sketch
+
+    cache_counter & local_counter(){
+        return counters[local().stripe];
+    }
+
+    //lookup through the admission sketch , counted
+    template<class F>
+    bool cache_get(value_cache_t & cache , uint32_t key_index , uint32_t ver , F && dest){
+        sketch.record(key_index);
+        const bool hit = cache.get(key_index , ver , std::forward<F>(dest));
+        (hit ? local_counter().hits : local_counter().misses).fetch_add(1 , std::memory_order_relaxed);
+        return hit;
+    }
+
+    //a new key only takes the place of one seen less often
+    void cache_put(value_cache_t & cache , uint32_t key_index , uint32_t ver , const char * key , const char * value , uint32_t len){
+        const bool stored = cache.put(key_index , ver , key , value , len , [this , key_index](uint32_t victim){
+            return sketch.admit(key_index , victim);
+        });
+        (stored ? local_counter().admitted : local_counter().rejected).fetch_add(1 , std::memory_order_relaxed);
+    }
+
+    //a hit in the hot table , dest as for cache_get. an entry counts
+    //only while its key has not been written since the table was built
+    template<class F>
+    bool hot_get(const char * key , uint64_t hash , F && dest){
+        auto & info = local();
+        const bool hit = hot.read(info.stripe , [this , key , hash , &dest](const hot_table * table){
+            auto * e = table ? table->find(key , hash) : nullptr;
+            if(!e || ver_seq[e->key_index].load(std::memory_order_acquire) != e->ver)
+                return false;
+            if(char * d = dest(e->key , e->len))
+                memcpy(d , table->value(*e) , e->len);
+            return true;
+        });
+        if(hit)
+            counters[info.stripe].hot_hits.fetch_add(1 , std::memory_order_relaxed);
+        return hit;
+    }
+
+    //threads of a stripe may overwrite each other's samples , it only
+    //makes the sampling a little sparser
+    struct alignas(CACHELINE_SIZE) sample_ring{
+        std::atomic<uint32_t> pos{0};
+        uint32_t taken{0};                      //by the background thread
+        std::atomic<uint32_t> keys[HOT_RING];
+    };
+
+    void sample_read(uint32_t key_index){
+        auto & info = local();
+        if(likely(++info.reads % HOT_SAMPLE))
+            return;
+        auto & ring = samples[info.stripe];
+        const uint32_t pos = ring.pos.load(std::memory_order_relaxed);
+        ring.keys[pos % HOT_RING].store(key_index , std::memory_order_relaxed);
+        ring.pos.store(pos + 1 , std::memory_order_release);
+    }
+
+    void refresh_hot();
+
+    write_lease lease_bucket();
+    bool switch_bucket(write_lease & lease);
+
+    value_cache_t & value_cache(){
+        #ifdef THREAD_LOCAL_CACHE
+        auto & info = local();
+        if(unlikely(!info.cache))
+            info.cache.reset(new value_cache_t(layout.cache_bytes / layout.n_bucket , local_cache_bytes));
+        return *info.cache;
+        #else
+        return shared_cache;
+        #endif
+    }
+
+    static uint32_t key_prefix(const char * key){
+        return *reinterpret_cast<const uint32_t *>(key);
+    }
+
+    struct batch_op{
+        const std::string * key;
+        const std::string * value;
+        uint64_t hash;
+        uint32_t key_index;
+        bool is_new;
+        block_index block;
+        Slice stored;           //value as laid in blocks
+        std::string packed;     //compressed value , if stored is not the value
+    };
+
+    static size_t read_file_meta(const std::string & name , engine_meta & m);
+    static bool make_layout(size_t file_size , size_t key_area , size_t partitions , size_t head_size , size_t cache_budget , layout_info & layout);
+
     void recovery();
+    void init_meta();
     void first_init();
+    bool load_checkpoint();
+    bool dump_checkpoint();
+    void set_clean(bool clean);
     uint32_t search(const Slice & key , uint64_t hash) ;
-    Status update(const Slice & value , uint64_t hash , uint32_t key_index , uint32_t bucket_id);
-    Status append(const Slice & key , const Slice & value , uint64_t hash , uint32_t bucket_id);
-    uint32_t search_get(const Slice & key , uint64_t hash , lru_cache_t & cache);
+    Status update(const Slice & key , const Slice & value , const Slice & stored , uint64_t hash , uint32_t key_index , uint32_t bucket_id);
+    Status append(const Slice & key , const Slice & value , const Slice & stored , uint64_t hash , uint32_t bucket_id);
+    Status write_batch(std::vector<batch_op> & ops , uint32_t bucket_id);
+    uint32_t search_get(const Slice & key , uint64_t hash , value_cache_t & cache);
+    Status get_value(const Slice & key , uint64_t hash , std::string & value , value_cache_t & cache);
 
-    block_index alloc_value_blocks(uint32_t bucket_id , uint32_t len);
+    block_index alloc_value_blocks(uint32_t bucket_id , uint32_t key_index , uint32_t len , bool fresh = true);
     void recollect_value_blocks(uint32_t bucket_id , block_index & block , uint32_t len);
     void write_value(const Slice & value  , block_index & block ,block_index & indics );
-    void read_value(const Slice & key , std::string & value , uint32_t key_index , lru_cache_t & cache);
+    void commit_value(head_info & head , head_info & new_head , const Slice & stored);
+    bool copy_intact(uint32_t key_index , const head_info & head , uint32_t copy , uint32_t len);
+    void copy_value(const Slice & value , block_index & indics);
+    void rollback_batch_head(head_info & head);
+    void persist_tombstone(head_info & head);
+    Status read_value(const Slice & key , std::string & value , uint32_t key_index , value_cache_t & cache);
+    bool copy_blocks(const head_info & head , char * buf);
+    void copy_stored(const head_info & head , char * buf);
+    uint32_t value_pieces(const head_info & head , Slice * pieces);
+    Slice pack_value(const Slice & value , std::string & buf);
+    block_index place_value(uint32_t bucket_id , uint32_t key_index , uint32_t copy , const Slice & stored , uint32_t len , bool fresh = true);
 
     uint32_t get_bucket_id(){
-        return thread_seq ++ % BUCKET_CNT;
+        return thread_seq ++ % layout.n_bucket;
+    }
+
+    engine_meta * meta(){
+        return reinterpret_cast<engine_meta *>(file.meta);
     }
 
     uint32_t new_key_info(uint32_t bucket_id){
-        constexpr auto n_key_per_bk = N_KEY / BUCKET_CNT;
-        auto seq = bucket_infos[bucket_id].key_seq ++;
-        return seq < n_key_per_bk ? seq + bucket_id * n_key_per_bk : index.null_id;
+        auto & free_keys = bucket_infos[bucket_id].free_keys;
+        if(!free_keys.empty()){
+            auto key_index = free_keys.back();
+            free_keys.pop_back();
+            return key_index;
+        }
+        auto key_index = next_key_info(bucket_id);
+        return likely(key_index != index.null_id) ? key_index : borrow_keys(bucket_id);
     }
 
+    uint32_t next_key_info(uint32_t bucket_id){
+        const auto seq = bucket_infos[bucket_id].keys.take(1);
+        return seq != split_range::null_off ? bucket_id * layout.n_key_per_bk + seq : index.null_id;
+    }
+
+    //lent chunks are counted in 16 bit
+    uint32_t key_chunk() const{
+        return std::max<uint32_t>(KEY_CHUNK , (layout.n_key_per_bk + UINT16_MAX - 1) / UINT16_MAX);
+    }
+
+    uint32_t borrow_keys(uint32_t bucket_id);
+    bool borrow_blocks(uint32_t bucket_id);
+    void mark_keys_lent(uint32_t bucket_id , uint16_t n_chunk);
+
+    //start of a run , or of a value inline in its slot
+    char * value_addr(const block_index & block){
+        return is_inline(block) ? file.inline_value(block[0] , block[2]) : reinterpret_cast<char *>(&file.value_blocks[block[0]]);
+    }
+
+    //over the key , the length and the bytes of one copy of a value
+    static uint32_t copy_crc(const char * key , uint32_t len , const Slice & stored){
+        uint32_t crc = crc32c(~0u , key , KEY_SIZE);
+        crc = crc32c(crc , &len , sizeof(len));
+        return ~crc32c(crc , stored.data() , stored.size());
+    }
+
+    static bool is_empty_head(const head_info & head){
+        return head.value_len == 0 && !(head.flags & HEAD_TOMBSTONE);
+    }
+
+    //f(addr , n) for every run of blocks holding a value of len bytes
+    template<class F>
+    static void for_each_run(const block_index & block , uint32_t len , F && f){
+        if(is_inline(block))
+            return;
+        if(likely(is_block_run(block))){
+            f(block[0] , run_blocks(stored_len(block , len)));
+            return;
+        }
+
+        //scattered pieces of an old file : 256B ones first , then a 128B tail
+        const auto n_block = run_blocks(len);
+        uint32_t i = 0;
+        for(; i < n_block / 2 ; ++i)
+            f(block[i] , 2);
+        if(n_block & 1)
+            f(block[i] , 1);
+    }
+
+    //writers of a key hold ver_seq odd , readers only wait while it is
+    void lock_key(uint32_t key_index){
+        auto & ver = ver_seq[key_index];
+        uint32_t cur = ver.load(std::memory_order_relaxed);
+        for(;;){
+            if(cur & 1){
+                _mm_pause();
+                cur = ver.load(std::memory_order_relaxed);
+            }else if(ver.compare_exchange_weak(cur , cur + 1))
+                return;
+        }
+    }
+
+    void unlock_key(uint32_t key_index){
+        ver_seq[key_index].fetch_add(1 , std::memory_order_release);
+    }
+
+    //ver_seq of key_index once no writer holds it
+    uint32_t stable_ver(uint32_t key_index){
+        uint32_t ver;
+        while((ver = ver_seq[key_index].load(std::memory_order_acquire)) & 1)
+            _mm_pause();
+        return ver;
+    }
+
+    //no writer took key_index since ver was read
+    bool unchanged(uint32_t key_index , uint32_t ver){
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return ver_seq[key_index].load(std::memory_order_relaxed) == ver;
+    }
+
+    //the index is read without the key held , so its head may have been
+    //deleted or reused for another key by the time it is looked at
+    static bool holds_key(const head_info & head , const char * key){
+        return !(head.flags & HEAD_TOMBSTONE) && fast_key_cmp_eq(head.key , key);
+    }
+
+    //a consistent copy of the head and the ver it was read at
+    bool read_head(uint32_t key_index , const char * key , head_info & head , uint32_t & ver){
+        do{
+            ver = stable_ver(key_index);
+            head = file.key_head(key_index);
+        }while(!unchanged(key_index , ver));
+        return holds_key(head , key);
+    }
+
+    //undoes new_key_info , a fresh head must not be left as a hole
+    void give_back_key(uint32_t bucket_id , uint32_t key_index){
+        auto & bucket = bucket_infos[bucket_id];
+        const auto seq = bucket.keys.low();
+        if(key_index + 1 == bucket_id * layout.n_key_per_bk + seq && is_empty_head(file.key_head(key_index)))
+            bucket.keys.set_low(seq - 1);
+        else
+            bucket.free_keys.push_back(key_index);
+    }
+
+    bool overlaps_window(const head_info & head){
+        bool hit = false;
+        for_each_run(head.index[head.index_flag] , head.value_len , [this , &hit](uint32_t addr , uint32_t n){
+            hit |= retiring.overlaps(addr , n);
+        });
+        return hit;
+    }
+
+    //under the alloc_lock the blocks were taken with
+    void note_owner(uint32_t addr , uint32_t n , uint32_t key_index){
+        if(!owners_on.load())
+            return;
+        for(uint32_t i = 0 ; i < n ; ++i)
+            block_owner[addr + i].store(key_index , std::memory_order_relaxed);
+    }
+
+    uint32_t compact();
+    uint32_t compact_partition(uint32_t bucket_id);
+    void find_owners();
+
     bool is_invalid_block(const block_index & block){
-        constexpr auto null = decltype(bucket_info{}.allocator)::null_index;
-        return block[0] == null || block[1] == null || block[2] == null || block[3] == null;
+        return block[0] == value_block_allocator::null_index;
     }
 
 private:
 
-    kv_file_info<N_KEY ,N_VALUE> file;
+    static std::atomic<uint64_t> instance_seq;
+
+    const layout_info layout;
+    kv_file_info file;
+    std::string ckpt_name;
+    const uint64_t instance_id;
     std::atomic<uint32_t> thread_seq{0};
+    std::atomic<uint32_t> stripe_seq{0};
 
     alignas(CACHELINE_SIZE)
-    std::array<bucket_info , BUCKET_CNT> bucket_infos;
+    std::array<bucket_info , MAX_BUCKET> bucket_infos;  //first layout.n_bucket in use
+    std::shared_ptr<lease_table> leases;
+    const numa_topology numa;       //one node unless numa_aware
 
-    open_address_hash<N_KEY * 2> index;     // 3.6GB
-    bitmap_filter<N_KEY * 8> bitset{};      // 228MB
+    index_t index;
+    blocked_bloom filter;       // 228MB
 
     std::unique_ptr<std::atomic<uint32_t>[]> ver_seq;   //896MB
 
-    static_assert(sizeof(bucket_info) == 64 , "");
-    static_assert(sizeof(bucket_infos) == 1_KB , "");
+    #ifndef THREAD_LOCAL_CACHE
+    value_cache_t shared_cache;
+    #else
+    std::shared_ptr<std::atomic<int64_t>> local_cache_bytes;   //outlives the engine with the threads
+    #endif
+    frequency_sketch sketch;
+    std::unique_ptr<cache_counter[]> counters;
+
+    std::unique_ptr<space_saving> hot_top;          //null if the hot table is off , background thread only
+    std::unique_ptr<sample_ring[]> samples;         //COUNTER_STRIPE
+    rcu_ptr<hot_table , COUNTER_STRIPE> hot;
+
+    block_window retiring;          //tail window being compacted
+    //block => key_index whose value took it , filled by the first pass and
+    //kept by writers from then on , so a pass scans only its window
+    std::unique_ptr<std::atomic<uint32_t>[]> block_owner;
+    std::atomic<bool> owners_on{false};
+    std::mutex compact_mutex;       //one pass at a time
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool background_stop{false};
+    std::thread background;         //compaction and hot table rebuilds
+
+    static_assert(sizeof(bucket_info) == 320 , "");
+    static_assert(sizeof(bucket_infos) == MAX_BUCKET * 320 , "");
 
 };
 
@@ -4,9 +4,9 @@ INCLUDE_DIR="../include"
 LIB_PATH="../lib"
 
 rm -rf ./judge
-rm -rf ./DB
+rm -rf ./DB ./DB.ckpt
 
-g++ -pthread -o judge judge.cpp random.cpp -L $LIB_PATH -lengine -lpmem -I $INCLUDE_DIR -g -mavx2 -std=c++11 -O2
+g++ -pthread -o judge judge.cpp random.cpp -L $LIB_PATH -lengine -lpmem -I $INCLUDE_DIR -g -msse4.1 -std=c++11 -O2
 
 if [ $? -ne 0 ]; then
     echo "Compile Error"
@@ -1,6 +1,13 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "fmt/format.h"
 #include "db.hpp"
@@ -10,7 +17,18 @@
 #include "allocator.hpp"
 #include "simple_test.hpp"
 #include "open_address_hash_index.hpp"
+#include "group_hash_index.hpp"
+#include "growable_hash_index.hpp"
 #include "lru_cache.hpp"
+#include "clock_cache.hpp"
+#include "frequency_sketch.hpp"
+#include "split_range.hpp"
+#include "lz_codec.hpp"
+#include "kvfile.hpp"
+#include "lease_table.hpp"
+#include "numa_topology.hpp"
+#include "rcu_ptr.hpp"
+#include "hot_table.hpp"
 
 std::vector<std::pair<Slice , Slice>> kv_pairs{};
 
@@ -122,10 +140,1196 @@ void test_recovery(){
     ASSERT(str == v.to_string());
 }
 
+void test_multi_get(){
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+
+    std::vector<Slice> keys{};
+    for(auto & kv : kv_pairs)
+        keys.push_back(kv.first);
+
+    char key_s[16];
+    memset(key_s, 'z' + 1, 16);
+    keys.emplace_back(key_s , 16);
+
+    std::vector<std::string> values(keys.size());
+    std::vector<Status> out(keys.size());
+    ASSERT(db->MultiGet(keys.data() , keys.size() , values.data() , out.data()) == NotFound);
+
+    for(uint i = 0 ; i < kv_pairs.size() ; ++i){
+        ASSERT(out[i] == Ok);
+        ASSERT(values[i] == kv_pairs[i].second.to_string());
+    }
+    ASSERT(out.back() == NotFound);
+}
+
+void test_write_batch(){
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+
+    static std::vector<std::string> values{};
+    for(uint i = 0 ; i < 8 ; ++i)
+        values.push_back(std::string(100 + i * 100 , 'a' + i));
+
+    //updates of existing keys , one key twice
+    WriteBatch batch{};
+    for(uint i = 0 ; i < 4 ; ++i)
+        batch.Put(kv_pairs[i].first , Slice{&values[i][0] , values[i].size()});
+    batch.Put(kv_pairs[0].first , Slice{&values[4][0] , values[4].size()});
+
+    //new keys
+    static char new_keys[3][16];
+    for(uint i = 0 ; i < 3 ; ++i){
+        memset(new_keys[i] , 'A' + i , 16);
+        batch.Put(Slice{new_keys[i] , 16} , Slice{&values[5 + i][0] , values[5 + i].size()});
+    }
+    ASSERT(batch.Count() == 8);
+    ASSERT(db->Write(batch) == Ok);
+
+    for(uint i = 1 ; i < 4 ; ++i)
+        kv_pairs[i].second = Slice{&values[i][0] , values[i].size()};
+    kv_pairs[0].second = Slice{&values[4][0] , values[4].size()};
+    for(uint i = 0 ; i < 3 ; ++i)
+        kv_pairs.emplace_back(Slice{new_keys[i] , 16} , Slice{&values[5 + i][0] , values[5 + i].size()});
+
+    for(auto & kv : kv_pairs){
+        std::string str{};
+        ASSERT(db->Get(kv.first , &str) == Ok);
+        ASSERT(str == kv.second.to_string());
+    }
+}
+
+void test_zero_copy_get(){
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+
+    char buf[1024];
+    for(auto & kv : kv_pairs){
+        size_t len{};
+        ASSERT(db->Get(kv.first , buf , sizeof(buf) , &len) == Ok);
+        ASSERT(std::string(buf , len) == kv.second.to_string());
+
+        //served from cache the second time
+        ASSERT(db->Get(kv.first , buf , sizeof(buf) , &len) == Ok);
+        ASSERT(std::string(buf , len) == kv.second.to_string());
+
+        if(len > 0){
+            ASSERT(db->Get(kv.first , buf , len - 1 , &len) == OutOfMemory);
+            ASSERT(len == kv.second.size());
+        }
+
+        PinnedValue pinned{};
+        ASSERT(db->GetPinned(kv.first , &pinned) == Ok);
+        std::string str{};
+        for(size_t i = 0 ; i < pinned.count ; ++i)
+            str.append(pinned.pieces[i].data() , pinned.pieces[i].size());
+        ASSERT(db->IsPinnedValid(pinned));
+        ASSERT(pinned.size == str.size());
+        ASSERT(str == kv.second.to_string());
+    }
+
+    char key_s[16];
+    memset(key_s, 'z' + 1, 16);
+    size_t len{};
+    PinnedValue pinned{};
+    ASSERT(db->Get(Slice{key_s , 16} , buf , sizeof(buf) , &len) == NotFound);
+    ASSERT(db->GetPinned(Slice{key_s , 16} , &pinned) == NotFound);
+
+    //an update invalidates the pinned view
+    auto & kv = kv_pairs.front();
+    ASSERT(db->GetPinned(kv.first , &pinned) == Ok);
+    ASSERT(db->Set(kv.first , kv.second) == Ok);
+    ASSERT(!db->IsPinnedValid(pinned));
+
+    //a view still valid after it was copied is never torn , also while
+    //the writer held the key when it was pinned
+    std::string key(16 , 'p');
+    const Slice k{&key[0] , 16};
+    ASSERT(db->Set(k , Slice{&key[0] , 16}) == Ok);
+    std::atomic<bool> stop{false};
+    std::thread writer([db , &k , &stop](){
+        for(uint32_t i = 0 ; !stop ; ++i){
+            std::string v(300 + i % 200 , char('a' + i % 26));
+            db->Set(k , Slice{&v[0] , v.size()});
+        }
+    });
+    uint32_t bad = 0;
+    for(uint32_t i = 0 ; i < 100000 ; ++i){
+        if(db->GetPinned(k , &pinned) != Ok)
+            continue;
+        std::string str{};
+        for(size_t j = 0 ; j < pinned.count ; ++j)
+            str.append(pinned.pieces[j].data() , pinned.pieces[j].size());
+        if(db->IsPinnedValid(pinned) && (str.size() != pinned.size || str != std::string(str.size() , str[0])))
+            ++bad;
+    }
+    stop = true;
+    writer.join();
+    ASSERT(bad == 0);
+    ASSERT(db->Delete(k) == Ok);
+}
+
+void test_delete(){
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+
+    auto kv = kv_pairs.back();
+    kv_pairs.pop_back();
+
+    std::string str{};
+    ASSERT(db->Delete(kv.first) == Ok);
+    ASSERT(db->Get(kv.first , &str) == NotFound);
+    ASSERT(db->Delete(kv.first) == NotFound);
+
+    //the deleted head is reused by the next new key
+    char key_s[16];
+    memset(key_s, 'z' + 2, 16);
+    Slice k(key_s , 16);
+    ASSERT(db->Set(k , kv.second) == Ok);
+    ASSERT(db->Get(k , &str) == Ok);
+    ASSERT(str == kv.second.to_string());
+    ASSERT(db->Delete(k) == Ok);
+
+    for(auto & p : kv_pairs){
+        ASSERT(db->Get(p.first , &str) == Ok);
+        ASSERT(str == p.second.to_string());
+    }
+
+    //tombstones survive a restart
+    guard.reset();
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    guard.reset(db);
+
+    ASSERT(db->Get(kv.first , &str) == NotFound);
+    ASSERT(db->Get(k , &str) == NotFound);
+    ASSERT(db->Set(kv.first , kv.second) == Ok);
+    ASSERT(db->Get(kv.first , &str) == Ok);
+    ASSERT(str == kv.second.to_string());
+    kv_pairs.push_back(kv);
+}
+
+//heads freed by a delete are reused while other threads still hold
+//their index , a value must never show up under another key
+void test_delete_reuse(){
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+
+    std::vector<std::string> keys{};
+    for(char c = 'a' ; c < 'i' ; ++c)
+        keys.emplace_back(16 , c);
+    auto value_of = [](const std::string & key , uint32_t n){
+        std::string v{};
+        for(uint32_t i = 0 ; i <= n % 8 ; ++i)
+            v += key;
+        return v;
+    };
+
+    std::atomic<uint32_t> bad{0};
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([db , &keys , &value_of , &bad , t](){
+            std::string str{};
+            for(uint32_t i = 0 ; i < 20000 ; ++i){
+                auto & key = keys[(i * 7 + t) % keys.size()];
+                Slice k{const_cast<char *>(key.data()) , 16};
+                if(t & 1){
+                    if(db->Get(k , &str) == Ok && (str.size() % 16 || str.find_first_not_of(key[0]) != std::string::npos))
+                        ++bad;
+                }else if(i % 3){
+                    auto v = value_of(key , i);
+                    db->Set(k , Slice{&v[0] , v.size()});
+                }else
+                    db->Delete(k);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+    ASSERT(bad == 0);
+
+    std::string str{};
+    for(auto & key : keys){
+        Slice k{const_cast<char *>(key.data()) , 16};
+        if(db->Get(k , &str) == Ok){
+            ASSERT(str.find_first_not_of(key[0]) == std::string::npos);
+            ASSERT(db->Delete(k) == Ok);
+        }
+    }
+}
+
+void test_checkpoint(){
+    auto verify = [](DB * db){
+        for(auto & kv : kv_pairs){
+            std::string str{};
+            ASSERT(db->Get(kv.first , &str) == Ok);
+            ASSERT(str == kv.second.to_string());
+        }
+    };
+
+    //closed cleanly by the previous test , opened from the checkpoint
+    FILE * f = fopen("./DB.ckpt" , "rb");
+    ASSERT(f);
+    fclose(f);
+
+    DB *db = nullptr;
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    std::unique_ptr<DB> guard(db);
+    verify(db);
+
+    //writes after a checkpoint reopen are kept
+    auto & kv = kv_pairs.front();
+    kv.second = kv_pairs.back().second;
+    ASSERT(db->Set(kv.first , kv.second) == Ok);
+    guard.reset();
+
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    guard.reset(db);
+    verify(db);
+    guard.reset();
+
+    //without a checkpoint the heads are scanned
+    ASSERT(remove("./DB.ckpt") == 0);
+    DB::CreateOrOpen("./DB", &db , nullptr);
+    guard.reset(db);
+    verify(db);
+}
+
+void test_checkpoint_fallback(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 4_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'f');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    auto value_of = [](uint32_t i , uint32_t round){
+        return std::string(100 + (i * 37 + round * 211) % 600 , char('a' + (i + round) % 26));
+    };
+    auto set = [&key_of , &value_of](DB * db , uint32_t i , uint32_t round){
+        auto key = key_of(i);
+        auto value = value_of(i , round);
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+
+    //free heads and free runs for the checkpoint to hold
+    const uint32_t n = 2000;
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(set(db , i , 0) == Ok);
+    for(uint32_t i = 0 ; i < n ; ++i){
+        auto key = key_of(i);
+        ASSERT(i % 4 == 0 ? db->Delete(Slice{&key[0] , 16}) == Ok : set(db , i , 1) == Ok);
+    }
+    guard.reset();
+
+    //the last bytes cut and the size in the header patched to match ,
+    //so everything but the tail loads before the checkpoint is refused
+    FILE * f = fopen("./DB_opt.ckpt" , "r+b");
+    ASSERT(f);
+    ASSERT(fseek(f , 0 , SEEK_END) == 0);
+    const uint64_t size = ftell(f) - 4;
+    ASSERT(fseek(f , 24 , SEEK_SET) == 0 && fwrite(&size , sizeof(size) , 1 , f) == 1);
+    ASSERT(fclose(f) == 0);
+    ASSERT(truncate("./DB_opt.ckpt" , size) == 0);
+
+    //recovery starts over , no head or block is handed out twice
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    for(uint32_t i = 0 ; i < n + 1000 ; ++i)
+        if(i % 4 == 0 || i >= n)
+            ASSERT(set(db , i , 2) == Ok);
+    for(uint32_t i = 0 ; i < n + 1000 ; ++i){
+        auto key = key_of(i);
+        std::string value{};
+        ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+        ASSERT(value == value_of(i , i % 4 == 0 || i >= n ? 2 : 1));
+    }
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_options(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+    options.cache_budget = 64_KB;
+
+    //more partitions than the header can hold
+    Options bad = options;
+    bad.partitions = 1024;
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , bad) == IOError);
+    Options bad_head = options;
+    bad_head.head_size = 96;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , bad_head) == IOError);
+
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    //one writer per partition
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([db , t](){
+            for(uint32_t i = t ; i < 1000 ; i += 4){
+                std::string key(16 , 'o') , value(100 + i % 500 , char('a' + i % 26));
+                memcpy(&key[0] , &i , sizeof(i));
+                ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+
+    auto verify = [](DB * db){
+        for(uint32_t i = 0 ; i < 1000 ; ++i){
+            std::string key(16 , 'o') , value{};
+            memcpy(&key[0] , &i , sizeof(i));
+            ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+            ASSERT(value == std::string(100 + i % 500 , char('a' + i % 26)));
+        }
+    };
+    verify(db);
+
+    //the file keeps its shape , other options are ignored on open
+    guard.reset();
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , bad) == Ok);
+    guard.reset(db);
+    verify(db);
+
+    guard.reset();
+    ASSERT(remove("./DB_opt.ckpt") == 0);
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db) == Ok);
+    guard.reset(db);
+    verify(db);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_partition_lease(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'l');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+
+    //more keys and values than one partition holds , the writer moves on
+    const uint32_t n = 5000;
+    std::thread([db , &key_of , n](){
+        for(uint32_t i = 0 ; i < n ; ++i){
+            auto key = key_of(i);
+            std::string value(700 , char('a' + i % 26));
+            ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+        }
+    }).join();
+
+    //more writers than partitions , each write borrows one
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 12 ; ++t){
+        ts.emplace_back([db , &key_of , n , t](){
+            for(uint32_t i = t ; i < n ; i += 12){
+                auto key = key_of(i);
+                std::string value(100 + i % 200 , char('A' + i % 26));
+                ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+
+    for(uint32_t i = 0 ; i < n ; ++i){
+        auto key = key_of(i);
+        std::string value{};
+        ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+        ASSERT(value == std::string(100 + i % 200 , char('A' + i % 26)));
+    }
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_partition_borrow(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'b');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    auto set = [&key_of](DB * db , uint32_t i){
+        auto key = key_of(i);
+        std::string value(600 + i % 100 , char('a' + i % 26));
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+    auto verify = [&key_of](DB * db , uint32_t n){
+        for(uint32_t i = 0 ; i < n ; ++i){
+            auto key = key_of(i);
+            std::string value{};
+            ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+            ASSERT(value == std::string(600 + i % 100 , char('a' + i % 26)));
+        }
+    };
+
+    //three idle threads keep their partitions , the writer can move nowhere
+    std::mutex m{};
+    std::condition_variable cv{};
+    uint32_t n_idle = 0;
+    bool done = false;
+    std::vector<std::thread> idle{};
+    for(uint32_t t = 0 ; t < 3 ; ++t){
+        idle.emplace_back([db , &set , &m , &cv , &n_idle , &done , t](){
+            const bool ok = set(db , 100000 + t) == Ok;
+            std::unique_lock<std::mutex> lock(m);
+            n_idle += ok;
+            cv.notify_all();
+            cv.wait(lock , [&done](){ return done; });
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock , [&n_idle](){ return n_idle == 3; });
+    }
+
+    //more keys and values than one partition holds
+    const uint32_t n = 6000;
+    std::thread([db , &set , n](){
+        for(uint32_t i = 0 ; i < n ; ++i)
+            ASSERT(set(db , i) == Ok);
+    }).join();
+    {
+        std::lock_guard<std::mutex> lock(m);
+        done = true;
+        cv.notify_all();
+    }
+    for(auto & t : idle) t.join();
+    verify(db , n);
+
+    //lent heads and blocks are found again by recovery
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db , n);
+    for(uint32_t i = n ; i < n + 500 ; ++i)
+        ASSERT(set(db , i) == Ok);
+
+    //and by the checkpoint
+    guard.reset();
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db , n + 500);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_value_compression(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 4_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+    options.compress_threshold = 256;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'z');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    //JSON-ish values compress , noisy ones are kept as they are
+    auto value_of = [](uint32_t i , uint32_t round){
+        std::string value{};
+        if(i % 3 == 0){
+            uint32_t x = i * 7919 + round;
+            value.resize(300 + i % 700);
+            for(auto & c : value) c = char((x = x * 1103515245 + 12345) >> 16);
+        }else{
+            for(uint32_t k = 0 ; value.size() < 200 + i % 800 ; ++k)
+                value += fmt::format("{{\"id\":{},\"round\":{},\"tag\":\"t{}\"}}," , i , round , k % 5);
+        }
+        return value;
+    };
+    auto set = [&key_of , &value_of](DB * db , uint32_t i , uint32_t round){
+        auto key = key_of(i);
+        auto value = value_of(i , round);
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+    auto verify = [&key_of , &value_of](DB * db , uint32_t n , uint32_t round){
+        char buf[1024];
+        for(uint32_t i = 0 ; i < n ; ++i){
+            auto key = key_of(i);
+            std::string value{};
+            ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+            ASSERT(value == value_of(i , round));
+            size_t len{};
+            ASSERT(db->Get(Slice{&key[0] , 16} , buf , sizeof(buf) , &len) == Ok);
+            ASSERT(std::string(buf , len) == value);
+        }
+    };
+
+    //more than the file holds uncompressed
+    const uint32_t n = 6000;
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(set(db , i , 0) == Ok);
+    verify(db , n , 0);
+
+    //the limit is on stored bytes , a long value that packs into a run fits
+    std::string long_value(4_KB , 'j');
+    auto long_key = key_of(n);
+    ASSERT(db->Set(Slice{&long_key[0] , 16} , Slice{&long_value[0] , long_value.size()}) == Ok);
+    std::string got{};
+    ASSERT(db->Get(Slice{&long_key[0] , 16} , &got) == Ok && got == long_value);
+    ASSERT(db->Delete(Slice{&long_key[0] , 16}) == Ok);
+
+    //compressed values can not be pinned , the others still can
+    PinnedValue pinned{};
+    auto key = key_of(100);
+    ASSERT(db->GetPinned(Slice{&key[0] , 16} , &pinned) == IOError);
+    key = key_of(3);
+    ASSERT(db->GetPinned(Slice{&key[0] , 16} , &pinned) == Ok);
+    ASSERT(pinned.size == value_of(3 , 0).size());
+
+    //updates and batches , their old blocks are freed by stored size
+    for(uint32_t i = 0 ; i < n ; i += 2)
+        ASSERT(set(db , i , 1) == Ok);
+    WriteBatch batch{};
+    for(uint32_t i = 1 ; i < n ; i += 2){
+        auto k = key_of(i);
+        batch.Put(Slice{&k[0] , 16} , Slice{&value_of(i , 1)[0] , value_of(i , 1).size()});
+        if(batch.Count() == 64){
+            ASSERT(db->Write(batch) == Ok);
+            batch.Clear();
+        }
+    }
+    ASSERT(db->Write(batch) == Ok);
+    verify(db , n , 1);
+
+    //compaction moves them as they are stored
+    db->Compact();
+    verify(db , n , 1);
+
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db , n , 1);
+
+    //a packed value that no longer decodes is an error , not garbage
+    guard.reset();
+    FILE * f = fopen("./DB_opt" , "r+b");
+    ASSERT(f);
+    const size_t n_key = 1_MB / 64 / 4 * 4;
+    long off = -1;
+    key = key_of(100);
+    for(size_t k = 0 ; k < n_key && off < 0 ; ++k){
+        head_info head{};
+        ASSERT(fseek(f , long(k) * 64 , SEEK_SET) == 0 && fread(&head , sizeof(head) , 1 , f) == 1);
+        auto & block = head.index[head.index_flag];
+        if(memcmp(head.key , key.data() , 16) == 0 && is_packed(block))
+            off = long(kv_file_info::value_offset(n_key , 64) + size_t(block[0]) * 128);
+    }
+    ASSERT(off >= 0);
+    //no literals and a match at offset 0
+    const char zeros[3]{};
+    ASSERT(fseek(f , off , SEEK_SET) == 0 && fwrite(zeros , 1 , sizeof(zeros) , f) == sizeof(zeros));
+    ASSERT(fclose(f) == 0);
+
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    std::string value{};
+    char buf[1024];
+    size_t len{};
+    ASSERT(db->Get(Slice{&key[0] , 16} , &value) == IOError);
+    ASSERT(db->Get(Slice{&key[0] , 16} , buf , sizeof(buf) , &len) == IOError);
+    auto other = key_of(101);
+    ASSERT(db->Get(Slice{&other[0] , 16} , &value) == Ok && value == value_of(101 , 1));
+    ASSERT(set(db , 100 , 2) == Ok);
+    ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok && value == value_of(100 , 2));
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_inline_values(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 4_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+    options.head_size = 256;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'i');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    //up to 96B stay in the slot , longer ones go to blocks
+    auto len_of = [](uint32_t i , uint32_t round){
+        return 1 + (i * 7 + round * 31) % 150;
+    };
+    auto set = [&key_of , &len_of](DB * db , uint32_t i , uint32_t round){
+        auto key = key_of(i);
+        std::string value(len_of(i , round) , char('a' + (i + round) % 26));
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+    auto verify = [&key_of , &len_of](DB * db , uint32_t n , uint32_t round){
+        for(uint32_t i = 0 ; i < n ; ++i){
+            auto key = key_of(i);
+            const std::string expect(len_of(i , round) , char('a' + (i + round) % 26));
+            std::string value{};
+            ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+            ASSERT(value == expect);
+
+            PinnedValue pinned{};
+            ASSERT(db->GetPinned(Slice{&key[0] , 16} , &pinned) == Ok);
+            ASSERT(pinned.count == 1 && pinned.size == expect.size());
+            ASSERT(pinned.pieces[0].to_string() == expect);
+            ASSERT(db->IsPinnedValid(pinned));
+        }
+    };
+
+    //a slot per key , 4096 keys in 1MB
+    const uint32_t n = 4000;
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(set(db , i , 0) == Ok);
+    verify(db , n , 0);
+
+    //values move between the slot and blocks
+    for(uint32_t i = 0 ; i < n ; i += 2)
+        ASSERT(set(db , i , 1) == Ok);
+    WriteBatch batch{};
+    for(uint32_t i = 1 ; i < n ; i += 2){
+        auto key = key_of(i);
+        std::string value(len_of(i , 1) , char('a' + (i + 1) % 26));
+        batch.Put(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    }
+    ASSERT(db->Write(batch) == Ok);
+    verify(db , n , 1);
+
+    //an update leaves the pinned copy of the slot behind
+    PinnedValue pinned{};
+    auto key = key_of(0);
+    ASSERT(db->GetPinned(Slice{&key[0] , 16} , &pinned) == Ok);
+    ASSERT(set(db , 0 , 1) == Ok);
+    ASSERT(!db->IsPinnedValid(pinned));
+
+    key = key_of(n - 1);
+    ASSERT(db->Delete(Slice{&key[0] , 16}) == Ok);
+    ASSERT(set(db , n - 1 , 1) == Ok);
+
+    //opened without options , the file keeps its slots
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db) == Ok);
+    guard.reset(db);
+    verify(db , n , 1);
+
+    guard.reset();
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db , n , 1);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_checksum_writes(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    //the check value of CRC-32C
+    ASSERT(~crc32c(~0u , "123456789" , 9) == 0xe3069283);
+
+    Options options{};
+    options.file_size = 4_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+    options.head_size = 256;
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'k');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    //inline and in blocks
+    auto value_of = [](uint32_t i , uint32_t round){
+        return std::string(1 + (i * 13 + round * 101) % 400 , char('a' + (i + round) % 26));
+    };
+    auto set = [&key_of , &value_of](DB * db , uint32_t i , uint32_t round){
+        auto key = key_of(i);
+        auto value = value_of(i , round);
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+    auto get = [&key_of](DB * db , uint32_t i , std::string & value){
+        auto key = key_of(i);
+        return db->Get(Slice{&key[0] , 16} , &value);
+    };
+
+    //written in order first , then checksummed over it
+    const uint32_t n = 2000;
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(set(db , i , 0) == Ok);
+
+    guard.reset();
+    options.checksum_writes = true;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    for(uint32_t i = 0 ; i < n ; i += 2)
+        ASSERT(set(db , i , 1) == Ok);
+    for(uint32_t i = n ; i < n + 100 ; ++i)
+        ASSERT(set(db , i , 0) == Ok);
+    //its old blocks are freed last , nothing takes them
+    ASSERT(set(db , 10 , 2) == Ok);
+    guard.reset();
+
+    //tear the last write of some keys , as a crash before the fence would
+    FILE * f = fopen("./DB_opt" , "r+b");
+    ASSERT(f);
+    const size_t n_key = 1_MB / 256 / 4 * 4;
+    //one writer thread , so keys sit in the slots in write order
+    auto tear = [f , n_key](uint32_t key_index){
+        head_info head{};
+        ASSERT(fseek(f , long(key_index) * 256 , SEEK_SET) == 0 && fread(&head , sizeof(head) , 1 , f) == 1);
+        auto & block = head.index[head.index_flag];
+        const long off = is_inline(block) ? long(key_index) * 256 + 64 + block[2] * 96
+            : long(kv_file_info::value_offset(n_key , 256) + size_t(block[0]) * 128);
+        char c{};
+        ASSERT(fseek(f , off , SEEK_SET) == 0 && fread(&c , 1 , 1 , f) == 1);
+        c = ~c;
+        ASSERT(fseek(f , off , SEEK_SET) == 0 && fwrite(&c , 1 , 1 , f) == 1);
+    };
+    //a crash keeps the old copy of a torn key , here slots and the last
+    //freed blocks. odd keys below n were written in order and are not checked
+    std::vector<uint32_t> torn{0 , 2 , 4 , 6 , 10 , n , n + 1 , n + 99};
+    for(auto i : torn)
+        tear(i);
+    ASSERT(fclose(f) == 0);
+
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+
+    //updated keys fall back a step , a first write is dropped
+    std::string value{};
+    for(uint32_t i = 0 ; i < n + 100 ; ++i){
+        const bool is_torn = std::find(torn.begin() , torn.end() , i) != torn.end();
+        const uint32_t round = i == 10 ? 2 : i < n && i % 2 == 0 ? 1 : 0;
+        if(is_torn && (i >= n || round == 0)){
+            ASSERT(get(db , i , value) == NotFound);
+            continue;
+        }
+        ASSERT(get(db , i , value) == Ok);
+        ASSERT(value == value_of(i , is_torn ? round - 1 : round));
+    }
+
+    //dropped heads are reused
+    for(auto i : torn)
+        ASSERT(set(db , i , 3) == Ok);
+    for(auto i : torn){
+        ASSERT(get(db , i , value) == Ok);
+        ASSERT(value == value_of(i , 3));
+    }
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_value_runs(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'r');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    auto value_of = [](uint32_t i , uint32_t round){
+        return std::string(1 + (i * 37 + round * 101) % 1024 , char('a' + (i + round) % 26));
+    };
+    auto verify = [&key_of , &value_of](DB * db , uint32_t round){
+        for(uint32_t i = 0 ; i < 2000 ; ++i){
+            auto key = key_of(i);
+            auto expect = value_of(i , i % 3 == 0 ? round : 0);
+            PinnedValue pinned{};
+            ASSERT(db->GetPinned(Slice{&key[0] , 16} , &pinned) == Ok);
+            ASSERT(pinned.count == 1 && pinned.size == expect.size());
+            ASSERT(pinned.pieces[0].to_string() == expect);
+            ASSERT(uintptr_t(pinned.pieces[0].data()) % (expect.size() > 128 ? 256 : 128) == 0);
+        }
+    };
+
+    //every size up to 1KB , then a third of them change size
+    for(uint32_t i = 0 ; i < 2000 ; ++i){
+        auto key = key_of(i) , value = value_of(i , 0);
+        ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+    }
+    for(uint32_t round = 1 ; round < 4 ; ++round){
+        for(uint32_t i = 0 ; i < 2000 ; i += 3){
+            auto key = key_of(i) , value = value_of(i , round);
+            ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+        }
+    }
+    verify(db , 3);
+
+    //rebuilt by a scan , new runs must not overlap live ones
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db , 3);
+    for(uint32_t i = 0 ; i < 2000 ; i += 3){
+        auto key = key_of(i) , value = value_of(i , 4);
+        ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+    }
+    verify(db , 4);
+
+    //a value longer than one run is refused , nothing of it is written
+    std::string big(1025 , 'x') , fits(1024 , 'y');
+    auto key = key_of(2000);
+    ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&big[0] , big.size()}) == IOError);
+    std::string value{};
+    ASSERT(db->Get(Slice{&key[0] , 16} , &value) == NotFound);
+    key = key_of(0);
+    ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&big[0] , big.size()}) == IOError);
+    WriteBatch batch{};
+    auto other = key_of(2001);
+    batch.Put(Slice{&other[0] , 16} , Slice{&fits[0] , fits.size()});
+    batch.Put(Slice{&key[0] , 16} , Slice{&big[0] , big.size()});
+    ASSERT(db->Write(batch) == IOError);
+    ASSERT(db->Get(Slice{&other[0] , 16} , &value) == NotFound);
+    verify(db , 4);
+    ASSERT(db->Set(Slice{&other[0] , 16} , Slice{&fits[0] , fits.size()}) == Ok);
+    ASSERT(db->Get(Slice{&other[0] , 16} , &value) == Ok && value == fits);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_recovery_free_space(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto set = [](DB * db , uint32_t i , uint32_t len){
+        std::string key(16 , 'f') , value(len , char('a' + i % 26));
+        memcpy(&key[0] , &i , sizeof(i));
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+
+    //5MB of values in a 7MB value area , then 4MB of them dropped
+    for(uint32_t i = 0 ; i < 5000 ; ++i)
+        ASSERT(set(db , i , 1000 + i % 24) == Ok);
+    for(uint32_t i = 0 ; i < 5000 ; ++i){
+        if(i % 5 == 0) continue;
+        std::string key(16 , 'f');
+        memcpy(&key[0] , &i , sizeof(i));
+        ASSERT(db->Delete(Slice{&key[0] , 16}) == Ok);
+    }
+
+    //without a checkpoint the space freed before must be found by the scan
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+
+    for(uint32_t i = 5000 ; i < 9000 ; ++i)
+        ASSERT(set(db , i , 1024) == Ok);
+    for(uint32_t i = 0 ; i < 9000 ; ++i){
+        if(i < 5000 && i % 5) continue;
+        std::string key(16 , 'f') , value{};
+        memcpy(&key[0] , &i , sizeof(i));
+        ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+        ASSERT(value == std::string(i < 5000 ? 1000 + i % 24 : 1024 , char('a' + i % 26)));
+    }
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_compaction(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 4_MB;
+    options.key_area = 2_MB;
+    options.partitions = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    auto key_of = [](uint32_t i){
+        std::string key(16 , 'c');
+        memcpy(&key[0] , &i , sizeof(i));
+        return key;
+    };
+    auto set = [&key_of](DB * db , uint32_t i , uint32_t len){
+        auto key = key_of(i);
+        std::string value(len , char('a' + i % 26));
+        return db->Set(Slice{&key[0] , 16} , Slice{&value[0] , value.size()});
+    };
+    auto check = [&key_of](DB * db , uint32_t i , uint32_t len){
+        auto key = key_of(i);
+        std::string value{};
+        ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+        ASSERT(value == std::string(len , char('a' + i % 26)));
+    };
+
+    //small values fill the file , every other one is dropped
+    uint32_t n = 0;
+    while(set(db , n , 100) == Ok)
+        ++n;
+    ASSERT(n > 10000);
+    for(uint32_t i = 0 ; i < n ; i += 2){
+        auto key = key_of(i);
+        ASSERT(db->Delete(Slice{&key[0] , 16}) == Ok);
+    }
+
+    //half the space is free , but only in 128B holes
+    ASSERT(set(db , n , 1024) == OutOfMemory);
+    for(uint32_t i = 0 ; i < 8 ; ++i)
+        ASSERT(db->Compact() == Ok);
+    for(uint32_t i = n ; i < n + 200 ; ++i)
+        ASSERT(set(db , i , 1024) == Ok);
+
+    for(uint32_t i = 1 ; i < n ; i += 2)
+        check(db , i , 100);
+    for(uint32_t i = n ; i < n + 200 ; ++i)
+        check(db , i , 1024);
+
+    //in the background , with writers changing sizes meanwhile
+    guard.reset();
+    options.compact_interval_ms = 1;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([db , t , n , &set](){
+            for(uint32_t round = 0 ; round < 4 ; ++round){
+                for(uint32_t i = 1 + t * 16 ; i < n ; i += 64)
+                    ASSERT(set(db , i , round % 2 ? 200 : 100) == Ok);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+
+    auto verify = [n , &check](DB * db){
+        for(uint32_t i = 1 ; i < n ; i += 2)
+            check(db , i , i % 16 == 1 ? 200 : 100);
+        for(uint32_t i = n ; i < n + 200 ; ++i)
+            check(db , i , 1024);
+    };
+    verify(db);
+
+    //moved values survive a restart without checkpoint
+    guard.reset();
+    remove("./DB_opt.ckpt");
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    guard.reset(db);
+    verify(db);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_cache_stats(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.cache_budget = 1_MB;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    std::vector<std::string> keys{};
+    for(uint32_t i = 0 ; i < 10 ; ++i){
+        keys.emplace_back(16 , 's');
+        memcpy(&keys.back()[0] , &i , sizeof(i));
+        std::string value(300 , char('a' + i));
+        ASSERT(db->Set(Slice{&keys.back()[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+    }
+
+    //first read fills the cache , second one hits
+    for(uint32_t round = 0 ; round < 2 ; ++round){
+        for(auto & key : keys){
+            std::string value{};
+            ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok);
+            ASSERT(value.size() == 300);
+        }
+    }
+
+    CacheStats stats{};
+    ASSERT(db->GetCacheStats(&stats) == Ok);
+    ASSERT(stats.misses == 10 && stats.hits == 10);
+    ASSERT(stats.admitted == 10 && stats.rejected == 0);
+    ASSERT(stats.hot_hits == 0);
+    std::vector<HotKey> hot{};
+    ASSERT(db->GetHotKeys(&hot) == IOError);
+
+    //10 values of 3 chunks within the budget
+    ASSERT(stats.capacity > 0 && stats.capacity <= 1_MB);
+    ASSERT(stats.bytes >= 10 * 384 && stats.bytes <= stats.capacity);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_hot_keys(){
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.hot_keys = 4;
+
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+
+    std::vector<std::string> keys{};
+    for(uint32_t i = 0 ; i < 100 ; ++i){
+        keys.emplace_back(16 , 'h');
+        memcpy(&keys.back()[0] , &i , sizeof(i));
+        std::string value(200 , char('a' + i % 26));
+        ASSERT(db->Set(Slice{&keys.back()[0] , 16} , Slice{&value[0] , value.size()}) == Ok);
+    }
+    const Slice hot_key{&keys[7][0] , 16};
+
+    //nothing sampled yet
+    std::vector<HotKey> hot{};
+    ASSERT(db->GetHotKeys(&hot) == Ok && hot.empty());
+
+    //two reads in three go to key 7 , until the background thread has
+    //rebuilt the table from them a few times
+    std::string value{};
+    uint32_t rounds = 0;
+    for(; rounds < 500 ; ++rounds){
+        for(uint32_t i = 0 ; i < 30000 ; ++i){
+            const auto & key = i % 3 ? keys[7] : keys[i / 3 % 100];
+            ASSERT(db->Get(Slice{const_cast<char *>(key.data()) , 16} , &value) == Ok);
+        }
+        CacheStats stats{};
+        ASSERT(db->GetCacheStats(&stats) == Ok);
+        if(stats.hot_hits > 10000) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    ASSERT(rounds < 500);
+    ASSERT(db->GetHotKeys(&hot) == Ok);
+    ASSERT(!hot.empty() && hot.size() <= 4);
+    ASSERT(hot[0].key == keys[7] && hot[0].reads > 0);
+
+    CacheStats before{} , after{};
+    ASSERT(db->GetCacheStats(&before) == Ok && before.hot_hits > 0);
+    ASSERT(db->Get(hot_key , &value) == Ok && value == std::string(200 , 'h'));
+    char buf[256];
+    size_t len = 0;
+    ASSERT(db->Get(hot_key , buf , 100 , &len) == OutOfMemory && len == 200);
+    ASSERT(db->Get(hot_key , buf , sizeof(buf) , &len) == Ok && len == 200 && buf[199] == 'h');
+    ASSERT(db->GetCacheStats(&after) == Ok && after.hot_hits == before.hot_hits + 3);
+
+    //a write takes the entry out at once , a rebuild may bring it back
+    ASSERT(db->Set(hot_key , Slice{const_cast<char *>("new value") , 9}) == Ok);
+    ASSERT(db->Get(hot_key , &value) == Ok && value == "new value");
+    ASSERT(db->Delete(hot_key) == Ok);
+    ASSERT(db->Get(hot_key , &value) == NotFound);
+
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
 void test_boolean_filter(){
-    bitmap_filter<34> bitset{};
-    ASSERT(bitset.max_index == 40 );
-    for(int i = 0 ; i< bitset.max_index ;++i){
+    bitmap_filter bitset{34};
+    ASSERT(bitset.max_index() == 40 );
+    for(int i = 0 ; i< bitset.max_index() ;++i){
         ASSERT(bitset.test(i) == false);
     }
     
@@ -139,6 +1343,33 @@ void test_boolean_filter(){
     // ASSERT(bitset.test(40) == false);
 }
 
+void test_blocked_bloom(){
+    blocked_bloom filter{1};
+    ASSERT(filter.max_index() == 512);
+
+    //8 bits a key , as the engine sizes it
+    const uint32_t n = 100000;
+    blocked_bloom bloom{size_t(n) * 8};
+    std::vector<uint64_t> hashes(n * 2);
+    char key[16]{};
+    for(uint32_t i = 0 ; i < n * 2 ; ++i){
+        memcpy(key , &i , sizeof(i));
+        hashes[i] = hash_bytes_16(key);
+    }
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(!bloom.may_contain(hashes[i]));
+    for(uint32_t i = 0 ; i < n ; ++i)
+        bloom.add(hashes[i]);
+
+    //no false negatives , few false positives
+    uint32_t fp = 0;
+    for(uint32_t i = 0 ; i < n ; ++i)
+        ASSERT(bloom.may_contain(hashes[i]));
+    for(uint32_t i = n ; i < n * 2 ; ++i)
+        fp += bloom.may_contain(hashes[i]);
+    ASSERT(fp < n / 20);
+}
+
 void test_fast_key_cmp(){
     std::string s1 = std::string(8 , 'a') + std::string(8 , 'b');
     std::string s2 = s1;
@@ -190,34 +1421,243 @@ void test_hash_index(){
 }
 
 void test_allocator(){
-    value_block_allocator<6> allctr{};
+    value_block_allocator allctr{};
 
-    allctr.init(32,0);
+    allctr.init(32,0,12);
 
-    ASSERT(allctr.allocate_128() == 32);
-    ASSERT(allctr.allocate_256() == 34);
-    ASSERT(allctr.allocate_256() == 36);
+    //a single block leaves the other half of its line free
+    ASSERT(allctr.allocate(1) == 32);
+    ASSERT(allctr.allocate(2) == 34);
+    ASSERT(allctr.allocate(3) == 36);
+    ASSERT(allctr.allocate(1) == 39);
+    ASSERT(allctr.allocate(1) == 33);
 
-    allctr.recollect_256(28);
+    //runs come back by length
+    allctr.recollect(34 , 2);
+    ASSERT(allctr.allocate(2) == 34);
+    allctr.recollect(36 , 3);
+    ASSERT(allctr.allocate(3) == 36);
 
-    ASSERT(allctr.allocate_128() == 33);
-    ASSERT(allctr.allocate_128() == 28);
-    ASSERT(allctr.allocate_128() == 29);
+    //the tail is used up before a larger run is split
+    ASSERT(allctr.allocate(4) == 40);
+    ASSERT(allctr.allocate(1) == allctr.null_index);
+    allctr.recollect(40 , 4);
+    ASSERT(allctr.allocate(1) == 40);
+    //split off the line , 41 goes alone and 42 keeps a whole line
+    ASSERT(allctr.allocate(1) == 41);
+    ASSERT(allctr.allocate(2) == 42);
+    ASSERT(allctr.allocate(1) == allctr.null_index);
 
-    allctr.recollect_128(1024);
-    allctr.recollect_256(34);
-    
-    ASSERT(allctr.allocate_128() == 1024);
-    ASSERT(allctr.allocate_128() == 34);
+    //an old file's scattered 128B piece
+    allctr.recollect(1024 , 1);
+    ASSERT(allctr.allocate(1) == 1024);
+    ASSERT(allctr.allocate(8) == allctr.null_index);
+
+    //recovery rounds the tail to a line
+    allctr.init(32 , 3 , 12);
+    ASSERT(allctr.allocate(2) == 36);
+
+    //lent chunks come off the far end , the tail stops below them
+    ASSERT(allctr.lend(4) == 40);
+    ASSERT(allctr.lend(4) == allctr.null_index);
+    ASSERT(allctr.allocate(2) == 38);
+    ASSERT(allctr.allocate(2) == allctr.null_index);
+}
+
+void test_lz_codec(){
+    auto round_trip = [](const std::string & src){
+        std::string packed(src.size() + src.size() / 255 + 16 , 0);
+        const auto n = lz_codec::compress(src.data() , src.size() , &packed[0] , packed.size());
+        ASSERT(n > 0);
+        std::string out(src.size() , 0);
+        ASSERT(lz_codec::decompress(packed.data() , n , &out[0] , out.size()));
+        ASSERT(out == src);
+        return n;
+    };
+
+    ASSERT(round_trip("") == 1);
+    ASSERT(round_trip("abc") == 4);
+
+    std::string json{};
+    for(uint32_t i = 0 ; json.size() < 1000 ; ++i)
+        json += fmt::format("{{\"id\":{},\"name\":\"user{}\",\"active\":true}}," , i , i % 7);
+    ASSERT(round_trip(json) * 2 < json.size());
+    ASSERT(round_trip(std::string(1000 , 'x')) < 32);
+
+    std::string noise(1000 , 0);
+    uint32_t x = 12345;
+    for(auto & c : noise) c = char((x = x * 1103515245 + 12345) >> 16);
+    round_trip(noise);
+
+    //no room , no output
+    std::string packed(1000 , 0);
+    ASSERT(lz_codec::compress(noise.data() , noise.size() , &packed[0] , 896) == 0);
+
+    //a broken or truncated input is refused
+    const auto n = lz_codec::compress(json.data() , json.size() , &packed[0] , packed.size());
+    std::string out(json.size() , 0);
+    ASSERT(!lz_codec::decompress(packed.data() , n - 1 , &out[0] , out.size()));
+    ASSERT(!lz_codec::decompress(packed.data() , n , &out[0] , out.size() - 1));
+}
+
+void test_cpu_kernels(){
+    std::string src(4096 + 64 , 0);
+    uint32_t x = 777;
+    for(auto & c : src) c = char((x = x * 1103515245 + 12345) >> 16);
+
+    //every variant the host can run , straight and through the registry
+    std::vector<void (*)(void * , const void * , size_t)> variants{stream_lines_sse2 , cpu_kernels::get().stream_lines};
+    if(__builtin_cpu_supports("avx2")) variants.push_back(stream_lines_avx2);
+    if(__builtin_cpu_supports("avx512f")) variants.push_back(stream_lines_avx512);
+    for(auto stream_lines : variants){
+        alignas(64) char dst[1024];
+        memset(dst , 0 , sizeof(dst));
+        stream_lines(dst , src.data() + 3 , 15);
+        _mm_sfence();
+        ASSERT(memcmp(dst , src.data() + 3 , 15 * 64) == 0);
+        ASSERT(dst[15 * 64] == 0);
+    }
+
+    //ragged ends around the streamed lines
+    for(size_t n : {0 , 1 , 255 , 256 , 257 , 1000 , 4096}){
+        for(size_t off : {0 , 1 , 37 , 63}){
+            std::vector<char> buf(n + 128 , 0);
+            auto * dst = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(buf.data()) + 63) & ~uintptr_t(63)) + off;
+            stream_copy(dst , src.data() + off , n);
+            _mm_sfence();
+            ASSERT(memcmp(dst , src.data() + off , n) == 0);
+        }
+    }
 
-    ASSERT(allctr.allocate_128() == 35);
-    ASSERT(allctr.allocate_128() == allctr.null_index);
-    ASSERT(allctr.allocate_256() == allctr.null_index);
+    //batched hashes match the scalar one , whole vectors and tails
+    std::vector<const char *> keys{};
+    std::vector<uint64_t> expect{};
+    for(size_t i = 0 ; i < 37 ; ++i){
+        keys.push_back(src.data() + i * 17);
+        expect.push_back(hash_bytes_16(keys.back()));
+    }
+    std::vector<void (*)(const char * const * , size_t , uint64_t *)> hashers{hash_keys_scalar , cpu_kernels::get().hash_keys};
+    if(__builtin_cpu_supports("avx2")) hashers.push_back(hash_keys_avx2);
+    if(__builtin_cpu_supports("avx512dq")) hashers.push_back(hash_keys_avx512);
+    for(auto hash_keys : hashers){
+        for(size_t n : {0 , 3 , 4 , 8 , 13 , 37}){
+            std::vector<uint64_t> out(n + 1 , 0);
+            hash_keys(keys.data() , n , out.data());
+            ASSERT(std::equal(out.begin() , out.begin() + n , expect.begin()));
+            ASSERT(out[n] == 0);
+        }
+    }
 
+    //both CRC32C kernels agree
+    ASSERT(~crc32c_table(~0u , "123456789" , 9) == 0xe3069283);
+    if(__builtin_cpu_supports("sse4.2"))
+        for(size_t n : {0 , 7 , 8 , 100 , 4096})
+            ASSERT(crc32c_table(~0u , src.data() + 1 , n) == crc32c_sse42(~0u , src.data() + 1 , n));
+}
+
+void test_numa_topology(){
+    //a fake sysfs tree : two nodes , the second one with a cpu gap
+    const std::string root = "./numa_fake";
+    auto put = [](const std::string & path , const char * text){
+        FILE * f = fopen(path.c_str() , "w");
+        ASSERT(f != nullptr);
+        fputs(text , f);
+        fclose(f);
+    };
+    mkdir(root.c_str() , 0755);
+    mkdir((root + "/node0").c_str() , 0755);
+    mkdir((root + "/node2").c_str() , 0755);
+    put(root + "/online" , "0,2\n");
+    put(root + "/node0/cpulist" , "0-3\n");
+    put(root + "/node2/cpulist" , "4-5,8\n");
+
+    auto topo = numa_topology::detect(root);
+    ASSERT(topo.n_node() == 2);
+    ASSERT(topo.node_of_cpu(3) == 0 && topo.node_of_cpu(4) == 1 && topo.node_of_cpu(8) == 1);
+    ASSERT(topo.node_of_cpu(100) == 0);
+    ASSERT(topo.first(0 , 7) == 0 && topo.first(1 , 7) == 3 && topo.first(2 , 7) == 7);
+
+    //anything unreadable is one node
+    put(root + "/node2/cpulist" , "4-x\n");
+    ASSERT(numa_topology::detect(root).n_node() == 1);
+    ASSERT(numa_topology::detect(root + "/missing").n_node() == 1);
+    ASSERT(numa_topology{}.first(1 , 7) == 7);
+
+    remove((root + "/node0/cpulist").c_str());
+    remove((root + "/node2/cpulist").c_str());
+    remove((root + "/online").c_str());
+    rmdir((root + "/node0").c_str());
+    rmdir((root + "/node2").c_str());
+    rmdir(root.c_str());
+
+    //partitions of a node first
+    lease_table leases{8};
+    ASSERT(leases.try_acquire(5 , 4 , 8) == 5);
+    ASSERT(leases.try_acquire(5 , 4 , 8) == 6);
+    ASSERT(leases.try_lock(7) && leases.try_lock(4));
+    ASSERT(leases.try_acquire(0 , 4 , 8) == lease_table::null_id);
+    ASSERT(leases.try_acquire(0) == 0);
+
+    //the host's own layout , one node or more , serves as usual
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+    Options options{};
+    options.file_size = 8_MB;
+    options.key_area = 1_MB;
+    options.numa_aware = true;
+    DB *db = nullptr;
+    ASSERT(DB::CreateOrOpen("./DB_opt", &db , options) == Ok);
+    std::unique_ptr<DB> guard(db);
+    std::string key(16 , 'n') , value{};
+    ASSERT(db->Set(Slice{&key[0] , 16} , Slice{&key[0] , 16}) == Ok);
+    ASSERT(db->Get(Slice{&key[0] , 16} , &value) == Ok && value == key);
+    guard.reset();
+    remove("./DB_opt");
+    remove("./DB_opt.ckpt");
+}
+
+void test_split_range(){
+    split_range range{};
+    range.init(0 , 1 << 20);
+
+    //the owner takes from the bottom while others take chunks from the top
+    std::vector<std::vector<uint32_t>> got(4);
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([&range , &got , t](){
+            for(;;){
+                const auto off = t ? range.take_top(64) : range.take(1);
+                if(off == split_range::null_off) break;
+                got[t].push_back(off);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+    ASSERT(range.low() == range.high());
+
+    //every slot went exactly once
+    std::vector<bool> seen(1 << 20 , false);
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        for(auto off : got[t]){
+            for(uint32_t k = 0 ; k < (t ? 64u : 1u) ; ++k){
+                ASSERT(!seen[off + k]);
+                seen[off + k] = true;
+            }
+        }
+    }
+    ASSERT(std::count(seen.begin() , seen.end() , true) == (1 << 20));
+
+    //the owner may give back what it took last
+    range.init(0 , 8);
+    ASSERT(range.take(2) == 0);
+    range.set_low(1);
+    ASSERT(range.take(1) == 1);
+    ASSERT(range.take_top(6) == 2);
+    ASSERT(range.take(1) == split_range::null_off);
 }
 
 void test_open_address_hash(){
-    open_address_hash<32> index{};
+    open_address_hash index{32};
 
     index.insert(1,222 , 114);
     index.insert(1,333 , 514);
@@ -228,45 +1668,368 @@ void test_open_address_hash(){
     ASSERT(index.search(1,333 ,[](uint32_t key_id){return key_id == 114; })== index.null_id);
     ASSERT(index.search(1,222 ,[](uint32_t key_id){return key_id == 116; })== index.null_id);
 
+    ASSERT(index.peek(1 , 333) == 514);
+    ASSERT(index.peek(1 , 444) == index.null_id);
+
+    ASSERT(index.erase(1,222 ,[](uint32_t key_id){return key_id == 114; }) == 114 );
+    ASSERT(index.search(1,222 ,[](uint32_t key_id){return key_id == 114; }) == index.null_id );
+    ASSERT(index.search(1,333 ,[](uint32_t key_id){return key_id == 514; }) == 514 );
+    index.insert(1,444 , 1919);
+    ASSERT(index.search(1,444 ,[](uint32_t key_id){return key_id == 1919; }) == 1919 );
+
     //more test : out of range...
 }
 
+void test_group_address_hash(){
+    group_address_hash index{64};
+    ASSERT(index.size() == 64);
+
+    //same tag , same group
+    index.insert(1,0 , 114);
+    index.insert(1,0 , 514);
+
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 114; }) == 114 );
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 514; }) == 514 );
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 116; }) == index.null_id );
+    ASSERT(index.search(2,0 ,[](uint32_t key_id){return true; }) == index.null_id );
+    ASSERT(index.peek(1 , 0) == 114);
+
+    //full group spills over to the next one
+    for(uint32_t i = 0 ; i < 40 ; ++i)
+        index.insert(3 , 0 , 1000 + i);
+    for(uint32_t i = 0 ; i < 40 ; ++i)
+        ASSERT(index.search(3 , 0 , [i](uint32_t key_id){return key_id == 1000 + i; }) == 1000 + i);
+
+    ASSERT(index.erase(1,0 ,[](uint32_t key_id){return key_id == 114; }) == 114 );
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 114; }) == index.null_id );
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 514; }) == 514 );
+    index.insert(1,0 , 1919);
+    ASSERT(index.search(1,0 ,[](uint32_t key_id){return key_id == 1919; }) == 1919 );
+
+    //inserts racing for one home group , each key is found as soon as its
+    //insert returns , also past slots others have claimed but not tagged
+    group_address_hash shared{128};
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([&shared , t](){
+            for(uint32_t round = 0 ; round < 2000 ; ++round){
+                for(uint32_t k = t * 100 ; k < t * 100 + 24 ; ++k){
+                    shared.insert(k , 0 , k);
+                    ASSERT(shared.search(k , 0 , [k](uint32_t key_id){ return key_id == k; }) == k);
+                }
+                for(uint32_t k = t * 100 ; k < t * 100 + 24 ; ++k)
+                    ASSERT(shared.erase(k , 0 , [k](uint32_t key_id){ return key_id == k; }) == k);
+            }
+        });
+    }
+    for(auto & t : ts) t.join();
+}
+
+void test_growable_hash(){
+    growable_hash index{1 << 16 , 64};
+    auto hash_of = [](uint32_t i){ 
+        std::string key(16 , 'a');
+        memcpy(&key[0] , &i , sizeof(i));
+        return hash_bytes_16(key.data()); 
+    };
+
+    //4 writers race through several resizes
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([&index , &hash_of , t](){
+            for(uint32_t i = t ; i < 4000 ; i += 4)
+                index.insert(hash_of(i) , 0 , i);
+        });
+    }
+    for(auto & t : ts) t.join();
+
+    ASSERT(index.capacity() >= 8192);
+    for(uint32_t i = 0 ; i < 4000 ; ++i)
+        ASSERT(index.search(hash_of(i) , 0 , [i](uint32_t key_id){ return key_id == i; }) == i);
+    ASSERT(index.search(hash_of(4000) , 0 , [](uint32_t){ return true; }) == index.null_id);
+
+    for(uint32_t i = 0 ; i < 4000 ; i += 2)
+        ASSERT(index.erase(hash_of(i) , 0 , [i](uint32_t key_id){ return key_id == i; }) == i);
+    for(uint32_t i = 4000 ; i < 8000 ; ++i)
+        index.insert(hash_of(i) , 0 , i);
+    for(uint32_t i = 0 ; i < 8000 ; ++i){
+        auto expect = (i < 4000 && i % 2 == 0) ? index.null_id : i;
+        ASSERT(index.search(hash_of(i) , 0 , [i](uint32_t key_id){ return key_id == i; }) == expect);
+    }
+
+    //once migrated , only the last table is left
+    const size_t bucket_bytes = index.capacity() * sizeof(uint64_t);
+    ASSERT(index.memory_size() >= bucket_bytes && index.memory_size() < bucket_bytes + 1024);
+
+    //readers keep searching while a writer doubles it again and again
+    growable_hash grown{1 << 20 , 64};
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> lost{0};
+    for(uint32_t i = 0 ; i < 64 ; ++i)
+        grown.insert(hash_of(i) , 0 , i);
+    std::vector<std::thread> readers{};
+    for(uint32_t t = 0 ; t < 3 ; ++t){
+        readers.emplace_back([&grown , &hash_of , &stop , &lost](){
+            while(!stop)
+                for(uint32_t i = 0 ; i < 64 ; ++i)
+                    if(grown.search(hash_of(i) , 0 , [i](uint32_t key_id){ return key_id == i; }) != i) ++lost;
+        });
+    }
+    for(uint32_t i = 64 ; i < 200000 ; ++i)
+        grown.insert(hash_of(i) , 0 , i);
+    stop = true;
+    for(auto & t : readers) t.join();
+    ASSERT(lost == 0);
+    grown.search(hash_of(0) , 0 , [](uint32_t){ return true; });
+    ASSERT(grown.memory_size() < grown.capacity() * sizeof(uint64_t) * 2);
+}
+
 void test_lru_cache(){
-    lru_cache<int , std::string , 4> lru{};
+    //8 chunks , room for 4 values of 256B
+    lru_cache<int , int> lru{8};
+    auto value_of = [&lru](int key){
+        auto n = lru.get(key);
+        std::string str(n ? n->len : 0 , '\0');
+        if(n) lru.copy(n , &str[0]);
+        return str;
+    };
+    auto put = [&lru](int key , const std::string & str){
+        return lru.put(key , key * 10 , str.data() , str.size());
+    };
 
-    lru.put(1, "1111");
+    ASSERT(put(1, "1111"));
     ASSERT(lru.get(1) != nullptr );
-    ASSERT(*lru.get(1) == "1111");
+    ASSERT(lru.get(1)->meta == 10);
+    ASSERT(value_of(1) == "1111");
 
     ASSERT(lru.get(2) == nullptr);
 
-    lru.put(2, "22222");
-    lru.put(3, "33333");
-    lru.put(4, "44444");
+    ASSERT(put(2, std::string(256 , '2')));
+    ASSERT(put(3, std::string(256 , '3')));
+    ASSERT(put(4, std::string(200 , '4')));
+    ASSERT(lru.free_space() == 128);
 
-    lru.put(5,"555555");
+    //needs 2 chunks , 1 goes with the oldest value
+    ASSERT(put(5, std::string(129 , '5')));
 
     ASSERT(lru.get(1) == nullptr);
-    ASSERT(lru.get(2));
-    ASSERT(lru.get(3));
-    ASSERT(lru.get(4));
-    ASSERT(lru.get(5));
+    ASSERT(value_of(2) == std::string(256 , '2'));
+    ASSERT(value_of(3) == std::string(256 , '3'));
+    ASSERT(value_of(4) == std::string(200 , '4'));
+    ASSERT(value_of(5) == std::string(129 , '5'));
+
+    //replacing a value frees the old chunks first
+    ASSERT(put(2, "2"));
+    ASSERT(value_of(2) == "2");
+    ASSERT(lru.free_space() == 128 * 1);
+    ASSERT(lru.footprint() + lru.free_space() == lru.memory_size());
+
+    //larger than max_chunk chunks
+    ASSERT(!put(6, std::string(1025 , '6')));
+
+    //many keys through a small table keep probing right
+    for(int i = 100 ; i < 1100 ; ++i)
+        ASSERT(put(i , std::to_string(i)));
+    for(int i = 100 ; i < 1092 ; ++i)
+        ASSERT(lru.get(i) == nullptr);
+    for(int i = 1092 ; i < 1100 ; ++i)
+        ASSERT(value_of(i) == std::to_string(i));
+}
+
+void test_clock_cache(){
+    //below one set , gets a single set of 8 ways and 32 chunks
+    clock_cache<1024> cache{1};
+    ASSERT(cache.capacity() == 8);
+    const size_t empty = cache.footprint();
+    ASSERT(empty + 32 * 128 == cache.memory_size());
+
+    std::string key(16 , 'k') , value{};
+    auto copy = [&value](const char * , uint32_t n){ value.resize(n); return &value[0]; };
+
+    cache.put(1 , 7 , key.data() , "1111" , 4);
+    ASSERT(cache.get(1 , 7 , copy) && value == "1111");
+    ASSERT(!cache.get(1 , 8 , copy));       //stale version
+    ASSERT(!cache.get(2 , 7 , copy));
+    ASSERT(cache.footprint() == empty + 128);
+
+    cache.put(1 , 8 , key.data() , "22222" , 5);
+    ASSERT(cache.get(1 , 8 , copy) && value == "22222");
+    ASSERT(!cache.get(1 , 7 , copy));
+    ASSERT(cache.footprint() == empty + 128);
+
+    //too large to cache
+    std::string large(1025 , 'x');
+    ASSERT(!cache.put(3 , 0 , key.data() , large.data() , large.size()));
+    ASSERT(!cache.get(3 , 0 , copy));
+
+    //4 values of 1KB fill every chunk , a fifth one evicts by weight
+    for(uint32_t i = 10 ; i < 15 ; ++i){
+        std::string v(1024 , char('a' + i));
+        ASSERT(cache.put(i , 0 , key.data() , v.data() , v.size()));
+        ASSERT(cache.get(i , 0 , copy) && value == v);
+        ASSERT(cache.footprint() <= cache.memory_size());
+    }
+    uint32_t n_hit = 0;
+    for(uint32_t i = 10 ; i < 15 ; ++i)
+        n_hit += cache.get(i , 0 , copy);
+    ASSERT(n_hit == 4);
+    ASSERT(cache.footprint() == cache.memory_size());
+
+    //never more than its ways
+    for(uint32_t i = 0 ; i < 1000 ; ++i)
+        cache.put(i , 0 , key.data() , "v" , 1);
+    n_hit = 0;
+    for(uint32_t i = 0 ; i < 1000 ; ++i)
+        n_hit += cache.get(i , 0 , copy);
+    ASSERT(n_hit > 0 && n_hit <= 8);
+
+    //a rejected candidate leaves the set as it was
+    const size_t before = cache.footprint();
+    ASSERT(!cache.put(2000 , 0 , key.data() , large.data() , 1024 , [](uint32_t){ return false; }));
+    ASSERT(cache.footprint() == before);
+
+    //readers never see a torn value
+    std::atomic<bool> stop{false};
+    std::thread writer([&cache , &key , &stop](){
+        for(uint32_t i = 0 ; !stop ; ++i){
+            std::string v(1 + i % 300 , char('a' + i % 26));
+            cache.put(i % 4 , 0 , key.data() , v.data() , v.size());
+        }
+    });
+    for(uint32_t i = 0 ; i < 200000 ; ++i){
+        std::string v{};
+        if(cache.get(i % 4 , 0 , [&v](const char * , uint32_t n){ v.resize(n); return &v[0]; }))
+            ASSERT(!v.empty() && v == std::string(v.size() , v[0]));
+    }
+    stop = true;
+    writer.join();
+}
+
+void test_frequency_sketch(){
+    frequency_sketch sketch{64};
+
+    ASSERT(sketch.frequency(1) == 0);
+    for(uint32_t i = 0 ; i < 5 ; ++i)
+        sketch.record(1);
+    sketch.record(2);
+    ASSERT(sketch.frequency(1) == 5);
+    ASSERT(sketch.frequency(2) == 1);
+    ASSERT(sketch.admit(1 , 2) && !sketch.admit(2 , 1) && !sketch.admit(2 , 2));
+
+    //saturates
+    for(uint32_t i = 0 ; i < 100 ; ++i)
+        sketch.record(1);
+    ASSERT(sketch.frequency(1) == frequency_sketch::max_count);
+
+    //aged once 640 increments are seen
+    for(uint32_t i = 1000 ; i < 2000 ; ++i)
+        sketch.record(i);
+    ASSERT(sketch.frequency(1) < frequency_sketch::max_count);
+}
+
+void test_space_saving(){
+    space_saving top{16};
+    ASSERT(top.top(4).empty());
+
+    //key i is read i times , interleaved with one-off keys
+    for(uint32_t round = 0 ; round < 10 ; ++round){
+        for(uint32_t i = 1 ; i <= 10 ; ++i)
+            if(round < i) top.record(i);
+        top.record(1000 + round);
+    }
+    auto items = top.top(3);
+    ASSERT(items.size() == 3);
+    ASSERT(items[0].key_index == 10 && items[1].key_index == 9 && items[2].key_index == 8);
+    ASSERT(items[0].count == 10 && items[1].count == 9 && items[2].count == 8);
+
+    //counts were halved , a new hot key overtakes the old ones
+    for(uint32_t i = 0 ; i < 40 ; ++i)
+        top.record(77);
+    items = top.top(1);
+    ASSERT(items.size() == 1 && items[0].key_index == 77);
+
+    //full , a new key takes the place of the least counted and inherits its count
+    space_saving small{2};
+    small.record(1) , small.record(1) , small.record(1) , small.record(2);
+    small.record(3);
+    items = small.top(2);
+    ASSERT(items.size() == 2 && items[0].key_index == 1 && items[0].count == 3);
+    ASSERT(items[1].key_index == 3 && items[1].count == 2);
+}
+
+void test_rcu_ptr(){
+    //an object is marked dead before it is freed , no reader may see it so
+    struct probe{
+        std::atomic<uint32_t> live{1};
+        ~probe(){ live.store(0); }
+    };
+    rcu_ptr<probe , 4> ptr{};
+    ASSERT(!ptr.read(0 , [](const probe * p){ return p != nullptr; }));
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> dead{0};
+    std::vector<std::thread> ts{};
+    for(uint32_t t = 0 ; t < 4 ; ++t){
+        ts.emplace_back([&ptr , &stop , &dead , t](){
+            while(!stop){
+                ptr.read(t , [&dead](const probe * p){
+                    if(p && !p->live.load()) ++dead;
+                    return 0;
+                });
+            }
+        });
+    }
+    for(uint32_t i = 0 ; i < 20000 ; ++i)
+        ptr.publish(std::unique_ptr<probe>(new probe{}));
+    stop = true;
+    for(auto & t : ts) t.join();
+    ASSERT(dead == 0);
+    ASSERT(ptr.read(0 , [](const probe * p){ return p->live.load(); }) == 1);
 }
 
 void main_get_set_unit(){
     TEST(test_get_set_simple);
+    TEST(test_multi_get);
+    TEST(test_write_batch);
+    TEST(test_zero_copy_get);
+    TEST(test_delete);
+    TEST(test_delete_reuse);
+    TEST(test_checkpoint);
     TEST(test_recovery);
+    TEST(test_checkpoint_fallback);
+    TEST(test_options);
+    TEST(test_partition_lease);
+    TEST(test_partition_borrow);
+    TEST(test_value_runs);
+    TEST(test_value_compression);
+    TEST(test_inline_values);
+    TEST(test_checksum_writes);
+    TEST(test_recovery_free_space);
+    TEST(test_compaction);
+    TEST(test_cache_stats);
+    TEST(test_hot_keys);
 }
 
 void main_unit_test(){
     TEST(test_boolean_filter);
+    TEST(test_blocked_bloom);
     // TEST(test_fast_key_cmp);
     // TEST(test_fast_mem_cpy);
     // TEST(test_hash_bytes);
     TEST(test_hash_index);
     TEST(test_allocator);
+    TEST(test_split_range);
+    TEST(test_lz_codec);
+    TEST(test_cpu_kernels);
+    TEST(test_numa_topology);
     TEST(test_open_address_hash);
+    TEST(test_group_address_hash);
+    TEST(test_growable_hash);
     TEST(test_lru_cache);
+    TEST(test_clock_cache);
+    TEST(test_frequency_sketch);
+    TEST(test_space_saving);
+    TEST(test_rcu_ptr);
 }
 
 int main(){
@@ -5,9 +5,9 @@ INCLUDE_DIR="../include"
 LIB_PATH="../lib"
 
 rm -rf ./unit_test
-rm -rf ./DB
+rm -rf ./DB ./DB.ckpt
 
-g++ unit_test.cpp -o unit_test -L$LIB_PATH -I$INCLUDE_DIR -I$EXTERNEL_DIR -pthread -lengine -lpmem -I.. -DFMT_HEADER_ONLY -g -std=c++11 -O3 -mavx2
+g++ unit_test.cpp -o unit_test -L$LIB_PATH -I$INCLUDE_DIR -I$EXTERNEL_DIR -pthread -lengine -lpmem -I.. -DFMT_HEADER_ONLY -g -std=c++11 -O3
 
 if [ $? -ne 0 ]; then
     echo "Compile Error"